@@ -0,0 +1,292 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "characterizer.hpp"
+
+#include <math.h>
+
+using namespace p44;
+
+
+#define CHAR_RAMP_STEP_TIME (20*MilliSecond) // same as motor driver default
+#define CHAR_SETTLE_TIME 1.0 // [Seconds] after ramp down, before next grid point
+#define CSV_HEADER "point,targetPower,rampTime,rampExp,t_ms,event,power,direction,value"
+
+
+RampCharacterizer::RampCharacterizer() :
+  holdTime(0),
+  settleTime(CHAR_SETTLE_TIME),
+  stepTime(CHAR_RAMP_STEP_TIME),
+  csv(NULL),
+  currentPoint(0),
+  pointStart(Never),
+  lastZeroOn(Never),
+  simTimeStep(0.001),
+  nextSimPoint(0)
+{
+  pthread_mutex_init(&simMutex, NULL);
+}
+
+
+RampCharacterizer::~RampCharacterizer()
+{
+  if (csv) fclose(csv);
+  pthread_mutex_destroy(&simMutex);
+}
+
+
+ErrorPtr RampCharacterizer::parseList(const string &aList, std::vector<double> &aValues)
+{
+  aValues.clear();
+  const char *p = aList.c_str();
+  string part;
+  while (nextPart(p, part, ',')) {
+    double v;
+    if (sscanf(part.c_str(), "%lf", &v)!=1) return TextError::err("invalid number '%s' in list", part.c_str());
+    aValues.push_back(v);
+  }
+  if (aValues.empty()) return TextError::err("empty list");
+  return ErrorPtr();
+}
+
+
+void RampCharacterizer::setGrid(const std::vector<double> &aPowers, const std::vector<double> &aRampTimes, const std::vector<double> &aRampExps, double aHoldTime)
+{
+  grid.clear();
+  grid.reserve(aPowers.size()*aRampTimes.size()*aRampExps.size());
+  for (size_t i=0; i<aPowers.size(); i++) {
+    for (size_t j=0; j<aRampTimes.size(); j++) {
+      for (size_t k=0; k<aRampExps.size(); k++) {
+        GridPoint gp;
+        gp.power = aPowers[i];
+        gp.rampTime = aRampTimes[j];
+        gp.rampExp = aRampExps[k];
+        grid.push_back(gp);
+      }
+    }
+  }
+  holdTime = aHoldTime;
+}
+
+
+ErrorPtr RampCharacterizer::openCSV(const string &aFilePath)
+{
+  csv = fopen(aFilePath.c_str(), "w");
+  if (!csv) return SysError::errNo("cannot open characterization CSV file: ");
+  fprintf(csv, "%s\n", CSV_HEADER);
+  return ErrorPtr();
+}
+
+
+void RampCharacterizer::csvLine(string &aOut, size_t aPoint, MLMicroSeconds aTime, const char *aEvent, double aPower, int aDirection, double aValue)
+{
+  const GridPoint &gp = grid[aPoint];
+  string_format_append(aOut, "%d,%.1f,%.3f,%.2f,%.3f,%s,%.2f,%d,%.3f\n",
+    (int)aPoint, gp.power, gp.rampTime, gp.rampExp, (double)aTime/MilliSecond, aEvent, aPower, aDirection, aValue
+  );
+}
+
+
+
+// MARK: ===== hardware
+
+
+void RampCharacterizer::runOnHardware(DcMotorDriverPtr aMotorDriver, DigitalIoPtr aZeroInput, MLMicroSeconds aSampleInterval, StatusCB aDoneCB)
+{
+  motorDriver = aMotorDriver;
+  zeroInput = aZeroInput;
+  doneCB = aDoneCB;
+  motorDriver->setRampStepTime(stepTime);
+  motorDriver->setOutputChangedHandler(boost::bind(&RampCharacterizer::motorChanged, this, _1, _2));
+  zeroInput->setInputChangedHandler(boost::bind(&RampCharacterizer::zeroChanged, this, _1), 0, aSampleInterval);
+  currentPoint = 0;
+  runHardwarePoint();
+}
+
+
+void RampCharacterizer::runHardwarePoint()
+{
+  if (currentPoint>=grid.size()) {
+    motorDriver->stop();
+    LOG(LOG_NOTICE, "Characterization complete, %d grid points", (int)grid.size());
+    StatusCB cb = doneCB;
+    doneCB = NULL;
+    if (cb) cb(ErrorPtr());
+    return;
+  }
+  const GridPoint &gp = grid[currentPoint];
+  LOG(LOG_NOTICE, "Characterization point %d/%d: power=%.1f, rampTime=%.2f, rampExp=%.2f", (int)currentPoint+1, (int)grid.size(), gp.power, gp.rampTime, gp.rampExp);
+  DcMotorDriver::SequenceStepList steps;
+  DcMotorDriver::SequenceStep step;
+  step.direction = 1;
+  step.profile = DcMotorDriver::ramp_exp;
+  // - up and hold
+  step.power = gp.power;
+  step.rampTime = gp.rampTime;
+  step.rampExp = gp.rampExp;
+  step.runTime = holdTime;
+  steps.push_back(step);
+  // - down and settle
+  step.power = 0;
+  step.rampExp = -gp.rampExp;
+  step.runTime = settleTime;
+  steps.push_back(step);
+  pointStart = MainLoop::now();
+  lastZeroOn = Never;
+  motorDriver->runSequence(steps, boost::bind(&RampCharacterizer::hardwarePointDone, this));
+}
+
+
+void RampCharacterizer::hardwarePointDone()
+{
+  if (csv) fflush(csv);
+  currentPoint++;
+  runHardwarePoint();
+}
+
+
+void RampCharacterizer::motorChanged(double aPower, int aDirection)
+{
+  if (!csv || currentPoint>=grid.size()) return;
+  string line;
+  csvLine(line, currentPoint, MainLoop::now()-pointStart, "cmd", aPower, aDirection, 0);
+  fputs(line.c_str(), csv);
+}
+
+
+void RampCharacterizer::zeroChanged(bool aNewState)
+{
+  if (!csv || currentPoint>=grid.size()) return;
+  MLMicroSeconds now = MainLoop::now();
+  string line;
+  csvLine(line, currentPoint, now-pointStart, aNewState ? "zero_on" : "zero_off", motorDriver->getCurrentPower(), motorDriver->getCurrentDirection(), 0);
+  if (aNewState) {
+    if (lastZeroOn!=Never) {
+      // time for one rotation
+      csvLine(line, currentPoint, now-pointStart, "rotation", motorDriver->getCurrentPower(), motorDriver->getCurrentDirection(), (double)(now-lastZeroOn)/Second);
+    }
+    lastZeroOn = now;
+  }
+  fputs(line.c_str(), csv);
+}
+
+
+
+// MARK: ===== simulator
+
+
+ErrorPtr RampCharacterizer::runSimulated(const MotorSimulator::Params &aParams, double aTimeStep, int aThreads)
+{
+  simParams = aParams;
+  simTimeStep = aTimeStep>0 ? aTimeStep : 0.001;
+  simResults.clear();
+  simResults.resize(grid.size());
+  nextSimPoint = 0;
+  if (aThreads<1) aThreads = 1;
+  if ((size_t)aThreads>grid.size()) aThreads = (int)grid.size();
+  LOG(LOG_NOTICE, "Simulating %d grid points in %d threads", (int)grid.size(), aThreads);
+  std::vector<pthread_t> threads(aThreads);
+  int started = 0;
+  for (int i=0; i<aThreads; i++) {
+    if (pthread_create(&threads[i], NULL, simThreadFunc, this)!=0) break;
+    started++;
+  }
+  if (started==0) simThreadFunc(this); // no threads at all, do it here
+  for (int i=0; i<started; i++) pthread_join(threads[i], NULL);
+  // write in grid order, so output does not depend on thread timing
+  if (csv) {
+    for (size_t i=0; i<simResults.size(); i++) fputs(simResults[i].c_str(), csv);
+    fflush(csv);
+  }
+  return ErrorPtr();
+}
+
+
+void *RampCharacterizer::simThreadFunc(void *aArg)
+{
+  RampCharacterizer *self = static_cast<RampCharacterizer *>(aArg);
+  while (true) {
+    pthread_mutex_lock(&self->simMutex);
+    size_t p = self->nextSimPoint++;
+    pthread_mutex_unlock(&self->simMutex);
+    if (p>=self->grid.size()) break;
+    self->simulatePoint(p, self->simResults[p]);
+  }
+  return NULL;
+}
+
+
+void RampCharacterizer::simulatePoint(size_t aPoint, string &aOut)
+{
+  const GridPoint &gp = grid[aPoint];
+  // commanded power timeline, with the same step timing as the motor driver
+  std::vector<MLMicroSeconds> cmdTimes;
+  std::vector<double> cmdPowers;
+  std::vector<double> curve;
+  MLMicroSeconds t = 0;
+  for (int leg=0; leg<2; leg++) {
+    double from = leg==0 ? 0 : gp.power;
+    double to = leg==0 ? gp.power : 0;
+    int n = (int)(gp.rampTime*Second/stepTime)+1;
+    DcMotorDriver::calcRampCurve(curve, n, leg==0 ? gp.rampExp : -gp.rampExp, DcMotorDriver::ramp_exp);
+    for (int k=0; k<n; k++) {
+      cmdTimes.push_back(t);
+      cmdPowers.push_back(from+(to-from)*curve[k]);
+      t += stepTime;
+    }
+    cmdTimes.push_back(t);
+    cmdPowers.push_back(to);
+    t += (leg==0 ? holdTime : settleTime)*Second;
+  }
+  MLMicroSeconds end = t;
+  // run the model
+  MotorSimulator sim;
+  sim.setParams(simParams);
+  sim.reset(180); // start opposite of zero, like after a calibration round
+  size_t nextCmd = 0;
+  double power = 0;
+  bool zero = sim.zeroInput();
+  MLMicroSeconds lastZeroOnSim = Never;
+  MLMicroSeconds dt = simTimeStep*Second;
+  if (dt<1) dt = 1;
+  for (MLMicroSeconds now=0; now<=end; now+=dt) {
+    while (nextCmd<cmdTimes.size() && cmdTimes[nextCmd]<=now) {
+      if (cmdPowers[nextCmd]!=power) {
+        power = cmdPowers[nextCmd];
+        csvLine(aOut, aPoint, cmdTimes[nextCmd], "cmd", power, power>0 ? 1 : 0, 0);
+      }
+      nextCmd++;
+    }
+    sim.step(simTimeStep, power, 1);
+    bool z = sim.zeroInput();
+    if (z!=zero) {
+      zero = z;
+      csvLine(aOut, aPoint, now, z ? "zero_on" : "zero_off", power, power>0 ? 1 : 0, 0);
+      if (z) {
+        if (lastZeroOnSim!=Never) {
+          csvLine(aOut, aPoint, now, "rotation", power, 1, (double)(now-lastZeroOnSim)/Second);
+        }
+        lastZeroOnSim = now;
+      }
+    }
+  }
+}
@@ -0,0 +1,123 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __p44wiperd__characterizer__
+#define __p44wiperd__characterizer__
+
+#include "p44utils_common.hpp"
+
+#include "dcmotordriver.hpp"
+#include "motorsimulator.hpp"
+#include "digitalio.hpp"
+
+#include <pthread.h>
+
+using namespace std;
+
+namespace p44 {
+
+
+  class RampCharacterizer;
+  typedef boost::intrusive_ptr<RampCharacterizer> RampCharacterizerPtr;
+
+  /// Runs a grid of ramp sequences (ramp up to a power, hold, ramp down again) and writes commanded power
+  /// and observed zero position events as CSV, for comparing motors, PWM frequencies and ramp settings.
+  /// Runs either on the real hardware (one grid point after the other, via mainloop), or on the
+  /// MotorSimulator (grid points computed in parallel threads, much faster than real time).
+  class RampCharacterizer : public P44Obj
+  {
+    typedef struct {
+      double power; ///< target power of the ramp up
+      double rampTime; ///< [Seconds]
+      double rampExp; ///< ramp exponent (ramp down uses the negative)
+    } GridPoint;
+
+    std::vector<GridPoint> grid;
+    double holdTime; ///< time at target power [Seconds]
+    double settleTime; ///< time after ramp down before the next grid point [Seconds]
+    MLMicroSeconds stepTime; ///< ramp step time
+    FILE *csv;
+
+    // hardware run state
+    DcMotorDriverPtr motorDriver;
+    DigitalIoPtr zeroInput;
+    size_t currentPoint;
+    MLMicroSeconds pointStart;
+    MLMicroSeconds lastZeroOn;
+    StatusCB doneCB;
+
+    // simulator run state
+    MotorSimulator::Params simParams;
+    double simTimeStep;
+    std::vector<string> simResults; ///< CSV lines per grid point
+    size_t nextSimPoint;
+    pthread_mutex_t simMutex;
+
+  public:
+
+    RampCharacterizer();
+    virtual ~RampCharacterizer();
+
+    /// parse a comma separated list of numbers
+    /// @param aList the list text
+    /// @param aValues will receive the numbers
+    /// @return ok or error if list is empty or contains non-numbers
+    static ErrorPtr parseList(const string &aList, std::vector<double> &aValues);
+
+    /// define the grid: all combinations of the given powers, ramp times and exponents
+    /// @param aHoldTime time to hold the target power before ramping down again [Seconds]
+    void setGrid(const std::vector<double> &aPowers, const std::vector<double> &aRampTimes, const std::vector<double> &aRampExps, double aHoldTime);
+
+    /// open the CSV output file (and write the header line)
+    ErrorPtr openCSV(const string &aFilePath);
+
+    /// run the grid on the hardware
+    /// @param aMotorDriver the motor driver (its output changed handler is taken over)
+    /// @param aZeroInput the zero position input (its input changed handler is taken over)
+    /// @param aSampleInterval zero input polling interval, if the input cannot signal edges
+    /// @param aDoneCB called when all grid points are done
+    void runOnHardware(DcMotorDriverPtr aMotorDriver, DigitalIoPtr aZeroInput, MLMicroSeconds aSampleInterval, StatusCB aDoneCB);
+
+    /// run the grid on the simulator, synchronously
+    /// @param aParams simulator parameters
+    /// @param aTimeStep simulation time step (= zero input sampling resolution) [Seconds]
+    /// @param aThreads number of threads to run grid points in parallel
+    ErrorPtr runSimulated(const MotorSimulator::Params &aParams, double aTimeStep, int aThreads);
+
+  private:
+
+    void csvLine(string &aOut, size_t aPoint, MLMicroSeconds aTime, const char *aEvent, double aPower, int aDirection, double aValue);
+
+    void runHardwarePoint();
+    void hardwarePointDone();
+    void motorChanged(double aPower, int aDirection);
+    void zeroChanged(bool aNewState);
+
+    static void *simThreadFunc(void *aArg);
+    void simulatePoint(size_t aPoint, string &aOut);
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__characterizer__) */
@@ -25,17 +25,61 @@
 #include "application.hpp"
 
 #include <math.h>
+#include <string.h>
 
 using namespace p44;
 
 
 #pragma mark - DCMotorDriver
 
+#define RAMP_STEP_TIME (20*MilliSecond)
+#define PWM_RESOLUTION 0.1 // %
+#define POSITION_CONTROL_INTERVAL (5*MilliSecond) // fixed position control loop rate
+
+
 DcMotorDriver::DcMotorDriver(const char *aPWMOutput, const char *aCWDirectionOutput, const char *aCCWDirectionOutput) :
   currentPower(0),
   currentDirection(0),
-  sequenceTicket(0)
+  pwmResolution(PWM_RESOLUTION),
+  shadowPwm(-1),
+  shadowCW(-1),
+  shadowCCW(-1),
+  emergencyStopped(false),
+  sequenceTicket(0),
+  rampStepTime(RAMP_STEP_TIME),
+  rampStartPower(0),
+  rampTargetPower(0),
+  rampSteps(0),
+  rampStepNo(0),
+  rampBend(0),
+  rampSlope(0),
+  rampRunning(false),
+  rampReversalDirection(0),
+  rampBrakeStart(0),
+  rampBrakeEnd(0),
+  rampStepDue(Never),
+  waveMinPower(0),
+  waveMaxPower(0),
+  waveCrossingTime(0),
+  wavePeriod(0),
+  wavePhase(0),
+  wavePhaseIncrement(0),
+  waveRunning(false),
+  posTarget(0),
+  posLastAngle(0),
+  posInToleranceSince(Never),
+  posRunning(false),
+  reversalBrakePower(0),
+  reversalBrakeTime(0),
+  lastUsageUpdate(Never),
+  lastDrivingDirection(0)
 {
+  pthread_mutex_init(&outputMutex, NULL);
+  memset(&usage, 0, sizeof(usage));
+  memset(&outputWrites, 0, sizeof(outputWrites));
+  rampCurve.reserve(64); // usual ramps fit without reallocating
+  wavePeakPhase[0] = 0.25;
+  wavePeakPhase[1] = 0.75;
   pwmOutput = AnalogIoPtr(new AnalogIo(aPWMOutput, true, 0)); // off to begin with
   if (aCWDirectionOutput) {
     cwDirectionOutput = DigitalIoPtr(new DigitalIo(aCWDirectionOutput, true, false));
@@ -51,32 +95,143 @@ DcMotorDriver::~DcMotorDriver()
 {
   // stop power to motor
   setPower(0, 0);
+  pthread_mutex_destroy(&outputMutex);
 }
 
 
 
+// Note: output writes and shadow state are protected by outputMutex, because emergencyStop() may
+//   write the same outputs from the watchdog thread when the mainloop is late.
+
+void DcMotorDriver::writePwm(double aValue)
+{
+  pthread_mutex_lock(&outputMutex);
+  if (emergencyStopped) aValue = 0; // blocked until stop()
+  double q = floor(aValue/pwmResolution+0.5)*pwmResolution;
+  if (q==shadowPwm) {
+    outputWrites.suppressed++;
+  }
+  else {
+    shadowPwm = q;
+    outputWrites.issued++;
+    pwmOutput->setValue(q);
+  }
+  pthread_mutex_unlock(&outputMutex);
+}
+
+
+void DcMotorDriver::writeCW(bool aOn)
+{
+  pthread_mutex_lock(&outputMutex);
+  if ((int)aOn==shadowCW) {
+    outputWrites.suppressed++;
+  }
+  else {
+    shadowCW = aOn;
+    outputWrites.issued++;
+    cwDirectionOutput->set(aOn);
+  }
+  pthread_mutex_unlock(&outputMutex);
+}
+
+
+void DcMotorDriver::writeCCW(bool aOn)
+{
+  pthread_mutex_lock(&outputMutex);
+  if ((int)aOn==shadowCCW) {
+    outputWrites.suppressed++;
+  }
+  else {
+    shadowCCW = aOn;
+    outputWrites.issued++;
+    ccwDirectionOutput->set(aOn);
+  }
+  pthread_mutex_unlock(&outputMutex);
+}
+
+
+void DcMotorDriver::setPwmResolution(double aResolution)
+{
+  if (aResolution>0) pwmResolution = aResolution;
+}
+
+
 void DcMotorDriver::setDirection(int aDirection)
 {
   if (cwDirectionOutput) {
-    cwDirectionOutput->set(aDirection>0);
+    writeCW(aDirection>0);
     if (ccwDirectionOutput) {
-      ccwDirectionOutput->set(aDirection<0);
+      writeCCW(aDirection<0);
     }
   }
   if (aDirection!=currentDirection) {
     LOG(LOG_DEBUG, "Direction changed to %d", aDirection);
     currentDirection = aDirection;
+    if (aDirection!=0) {
+      if (lastDrivingDirection!=0 && aDirection!=lastDrivingDirection) {
+        usage.reversals++;
+      }
+      lastDrivingDirection = aDirection;
+    }
+  }
+}
+
+
+void DcMotorDriver::setBrake(double aBrakePower)
+{
+  // account as not powered, not driving
+  setPower(0, 0);
+  if (ccwDirectionOutput) {
+    // both half bridges on: motor is shorted and brakes actively
+    writeCW(true);
+    writeCCW(true);
+    writePwm(aBrakePower);
+  }
+}
+
+
+void DcMotorDriver::setReversalBrake(double aBrakePower, double aBrakeTime)
+{
+  reversalBrakePower = aBrakePower;
+  reversalBrakeTime = aBrakeTime*Second;
+}
+
+
+void DcMotorDriver::updateUsage()
+{
+  MLMicroSeconds now = MainLoop::now();
+  if (lastUsageUpdate!=Never && currentPower>0) {
+    double dt = (double)(now-lastUsageUpdate)/Second;
+    int i = currentDirection<0 ? 1 : 0;
+    usage.onTime[i] += dt;
+    usage.dutyTime[i] += dt*currentPower/100;
   }
+  lastUsageUpdate = now;
 }
 
 
+const DcMotorDriver::MotorUsage &DcMotorDriver::getUsage()
+{
+  updateUsage();
+  return usage;
+}
+
+
+
+void DcMotorDriver::setOutputChangedHandler(DCMotorStatusCB aOutputChangedCB)
+{
+  outputChangedCB = aOutputChangedCB;
+}
+
 
 void DcMotorDriver::setPower(double aPower, int aDirection)
 {
+  updateUsage(); // account for time spent with previous power
+  int previousDirection = currentDirection;
   if (aPower<=0) {
     // no power
     // - disable PWM
-    pwmOutput->setValue(0);
+    writePwm(0);
     // - off (= hold/brake with no power)
     setDirection(0);
   }
@@ -84,113 +239,466 @@ void DcMotorDriver::setPower(double aPower, int aDirection)
     // determine current direction
     if (currentDirection!=0 && aDirection!=0 && aDirection!=currentDirection) {
       // avoid reversing direction with power on
-      pwmOutput->setValue(0);
+      writePwm(0);
       setDirection(0);
     }
     // now set desired direction and power
     setDirection(aDirection);
-    pwmOutput->setValue(aPower);
+    writePwm(aPower);
   }
   if (aPower!=currentPower) {
     LOG(LOG_DEBUG, "Power changed to %.2f%%", aPower);
     currentPower = aPower;
   }
+  else if (currentDirection==previousDirection) {
+    return; // no change
+  }
+  if (outputChangedCB) outputChangedCB(currentPower, currentDirection, ErrorPtr());
 }
 
 
-#define RAMP_STEP_TIME (20*MilliSecond)
+void DcMotorDriver::setRampStepTime(MLMicroSeconds aStepTime)
+{
+  if (aStepTime>0) rampStepTime = aStepTime;
+}
 
 
 void DcMotorDriver::stop()
 {
   stopSequences();
   setPower(0, 0);
+  pthread_mutex_lock(&outputMutex);
+  emergencyStopped = false;
+  pthread_mutex_unlock(&outputMutex);
+}
+
+
+void DcMotorDriver::emergencyStop()
+{
+  // Note: if the mainloop is stuck inside an output write, this blocks. The watchdog thread then
+  //   stops feeding the hardware watchdog, which is the last resort in that case.
+  pthread_mutex_lock(&outputMutex);
+  emergencyStopped = true;
+  pwmOutput->setValue(0);
+  if (cwDirectionOutput) cwDirectionOutput->set(false);
+  if (ccwDirectionOutput) ccwDirectionOutput->set(false);
+  // shadow state is no longer valid, make sure next writes are issued
+  shadowPwm = -1;
+  shadowCW = -1;
+  shadowCCW = -1;
+  pthread_mutex_unlock(&outputMutex);
 }
 
 
 void DcMotorDriver::stopSequences()
 {
   MainLoop::currentMainLoop().cancelExecutionTicket(sequenceTicket);
+  rampRunning = false;
+  waveRunning = false;
+  posRunning = false;
+  rampStepDue = Never;
 }
 
 
 
-void DcMotorDriver::rampToPower(double aPower, int aDirection, double aRampTime, double aRampExp, DCMotorStatusCB aRampDoneCB)
+void DcMotorDriver::rampToPower(double aPower, int aDirection, double aRampTime, double aRampExp, DCMotorStatusCB aRampDoneCB, RampProfile aProfile)
 {
-  LOG(LOG_DEBUG, "+++ new ramp: power: %.2f%%..%.2f%%, direction:%d..%d with ramp time %.3f Seconds, exp=%.2f", currentPower, aPower, currentDirection, aDirection, aRampTime, aRampExp);
+  LOG(LOG_DEBUG, "+++ new ramp: power: %.2f%%..%.2f%%, direction:%d..%d with ramp time %.3f Seconds, exp=%.2f, profile=%d", currentPower, aPower, currentDirection, aDirection, aRampTime, aRampExp, aProfile);
+  // limit
+  if (aPower>100) aPower=100;
+  else if (aPower<0) aPower=0;
+  int numSteps = rampRunning && aDirection==currentDirection ? rampStepsFor(aPower-currentPower, aRampTime) : 0;
+  if (numSteps>1) {
+    // retarget the running ramp
+    // Note: immediate changes (single step) are not retargeted, they must apply now, not at the next scheduled step
+    LOG(LOG_DEBUG, "Retarget running ramp to %.2f%% in %d steps", aPower, numSteps);
+    rampStartPower = currentPower;
+    rampTargetPower = aPower;
+    rampSteps = numSteps;
+    rampStepNo = 0;
+    rampReversalDirection = 0;
+    calcRampCurve(rampCurve, numSteps, aRampExp, aProfile);
+    // bend the new curve with f*(1-f)^2 (which is 0 at both ends and has slope 0 at the end)
+    // such that its first step continues with the slope of the running ramp
+    double f1 = 1.0/numSteps;
+    rampBend = (rampSlope-(aPower-currentPower)*rampCurve[0])/(f1*(1-f1)*(1-f1));
+    rampDoneCB = aRampDoneCB;
+    // next step is already scheduled, keep its timing
+    return;
+  }
   MainLoop::currentMainLoop().cancelExecutionTicket(sequenceTicket);
+  rampRunning = false;
+  waveRunning = false;
+  posRunning = false;
+  rampStepDue = Never;
   if (aDirection!=currentDirection) {
+    if (currentPower!=0 && currentDirection!=0 && aDirection!=0) {
+      // reversal: single ramp down through zero and up in the new direction
+      MLMicroSeconds brakeTime = 0;
+      if (reversalBrakePower>0 && ccwDirectionOutput) brakeTime = reversalBrakeTime;
+      if (aRampTime>0) {
+        // absolute ramp time includes braking, remainder is split between ramp down and up
+        aRampTime -= (double)brakeTime/Second;
+        if (aRampTime<0) aRampTime = 0;
+        aRampTime /= 2;
+      }
+      int downSteps = rampStepsFor(currentPower, aRampTime);
+      int brakeSteps = (int)(brakeTime/rampStepTime);
+      int upSteps = rampStepsFor(aPower, aRampTime);
+      LOG(LOG_DEBUG, "Reversal ramp from %.2f%% to %.2f%% in %d+%d+%d steps", currentPower, aPower, downSteps, brakeSteps, upSteps);
+      rampStartPower = currentPower;
+      rampTargetPower = -aPower;
+      rampSteps = downSteps+brakeSteps+upSteps;
+      rampStepNo = 0;
+      rampReversalDirection = aDirection;
+      rampBrakeStart = downSteps;
+      rampBrakeEnd = downSteps+brakeSteps;
+      calcReversalCurve(rampCurve, currentPower, downSteps, brakeSteps, aPower, upSteps, aRampExp, aProfile);
+      rampBend = 0;
+      rampSlope = 0;
+      rampDoneCB = aRampDoneCB;
+      rampRunning = true;
+      rampStep();
+      return;
+    }
     if (currentPower!=0) {
       // ramp to zero first, then ramp up to new direction
       LOG(LOG_DEBUG, "Ramp trough different direction modes -> first ramp power down, then up again");
       if (aRampTime>0) aRampTime /= 2; // for absolute ramp time specificiation, just use half of the time for ramp up or down, resp. 
-      rampToPower(0, currentDirection, aRampTime, aRampExp, boost::bind(&DcMotorDriver::rampToPower, this, aPower, aDirection, aRampTime, aRampExp, aRampDoneCB));
+      rampToPower(0, currentDirection, aRampTime, aRampExp, boost::bind(&DcMotorDriver::rampToPower, this, aPower, aDirection, aRampTime, aRampExp, aRampDoneCB, aProfile), aProfile);
       return;
     }
     // set new direction
     setDirection(aDirection);
   }
-  // limit
-  if (aPower>100) aPower=100;
-  else if (aPower<0) aPower=0;
   // ramp to new value
-  double rampRange = aPower-currentPower;
+  numSteps = rampStepsFor(aPower-currentPower, aRampTime);
+  LOG(LOG_DEBUG, "Ramp power from %.2f%% to %.2f%% in %d steps", currentPower, aPower, numSteps);
+  // now set up and execute the ramp
+  rampStartPower = currentPower;
+  rampTargetPower = aPower;
+  rampSteps = numSteps;
+  rampStepNo = 0;
+  rampReversalDirection = 0;
+  calcRampCurve(rampCurve, numSteps, aRampExp, aProfile);
+  rampBend = 0;
+  rampSlope = 0;
+  rampDoneCB = aRampDoneCB;
+  rampRunning = true;
+  rampStep();
+}
+
+
+int DcMotorDriver::rampStepsFor(double aRampRange, double aRampTime)
+{
   MLMicroSeconds totalRampTime;
   if (aRampTime<0) {
     // specification is 0..100 ramp time, scale according to power difference
-    totalRampTime = fabs(rampRange)/100*(-aRampTime)*Second;
+    totalRampTime = fabs(aRampRange)/100*(-aRampTime)*Second;
   }
   else {
     // absolute specification
     totalRampTime = aRampTime*Second;
   }
-  int numSteps = (int)(totalRampTime/RAMP_STEP_TIME)+1;
-  LOG(LOG_DEBUG, "Ramp power from %.2f%% to %.2f%% in %lld uS (%d steps)", currentPower, aPower, totalRampTime, numSteps);
-  // now execute the ramp
-  rampStep(currentPower, aPower, numSteps, 0, aRampExp, aRampDoneCB);
+  return (int)(totalRampTime/rampStepTime)+1;
+}
+
+
+double DcMotorDriver::rampCurvePoint(double aF, double aRampExp, double aExpNorm, RampProfile aProfile)
+{
+  if (aRampExp!=0) {
+    aF = (exp(aF*aRampExp)-1)/aExpNorm;
+  }
+  if (aProfile==ramp_scurve) {
+    // raised cosine: zero slope at both ends
+    aF = (1-cos(aF*M_PI))/2;
+  }
+  return aF;
 }
 
 
+void DcMotorDriver::calcRampCurve(std::vector<double> &aCurve, int aNumSteps, double aRampExp, RampProfile aProfile)
+{
+  aCurve.resize(aNumSteps);
+  double expNorm = aRampExp!=0 ? exp(aRampExp)-1 : 1;
+  for (int i=1; i<=aNumSteps; i++) {
+    aCurve[i-1] = rampCurvePoint((double)i/aNumSteps, aRampExp, expNorm, aProfile);
+  }
+}
+
+
+void DcMotorDriver::calcReversalCurve(std::vector<double> &aCurve, double aFromPower, int aDownSteps, int aBrakeSteps, double aToPower, int aUpSteps, double aRampExp, RampProfile aProfile)
+{
+  aCurve.resize(aDownSteps+aBrakeSteps+aUpSteps);
+  double expNorm = aRampExp!=0 ? exp(aRampExp)-1 : 1;
+  // fraction of the signed power range at which power crosses zero
+  double z = aFromPower/(aFromPower+aToPower);
+  int k = 0;
+  for (int i=1; i<=aDownSteps; i++) {
+    aCurve[k++] = z*rampCurvePoint((double)i/aDownSteps, aRampExp, expNorm, aProfile);
+  }
+  for (int i=1; i<=aBrakeSteps; i++) {
+    aCurve[k++] = z;
+  }
+  for (int i=1; i<=aUpSteps; i++) {
+    aCurve[k++] = z+(1-z)*rampCurvePoint((double)i/aUpSteps, aRampExp, expNorm, aProfile);
+  }
+}
+
 
-void DcMotorDriver::rampStep(double aStartPower, double aTargetPower, int aNumSteps, int aStepNo , double aRampExp, DCMotorStatusCB aRampDoneCB)
+void DcMotorDriver::rampStep()
 {
-  LOG(LOG_DEBUG, "ramp step #%d/%d, %d%% of ramp", aStepNo, aNumSteps, aStepNo*100/aNumSteps);
-  if (aStepNo++>=aNumSteps) {
+  LOG(LOG_DEBUG, "ramp step #%d/%d, %d%% of ramp", rampStepNo, rampSteps, rampStepNo*100/rampSteps);
+  if (rampStepDue!=Never) {
+    MLMicroSeconds late = MainLoop::now()-rampStepDue;
+    rampStepLatency.add(late>0 ? late : 0);
+    rampStepDue = Never;
+  }
+  if (rampStepNo++>=rampSteps) {
     // finalize
-    setPower(aTargetPower, currentDirection);
+    rampRunning = false;
+    rampSlope = 0;
+    if (rampReversalDirection) {
+      setPower(-rampTargetPower, rampReversalDirection);
+      rampReversalDirection = 0;
+    }
+    else {
+      setPower(rampTargetPower, currentDirection);
+    }
     LOG(LOG_DEBUG, "--- end of ramp");
     // call back
-    if (aRampDoneCB) aRampDoneCB(currentPower, currentDirection, ErrorPtr());
+    DCMotorStatusCB cb = rampDoneCB;
+    rampDoneCB = NULL;
+    if (cb) cb(currentPower, currentDirection, ErrorPtr());
   }
   else {
-    // set power for this step
-    double f = (double)aStepNo/aNumSteps;
-    if (aRampExp!=0) {
-      f = (exp(f*aRampExp)-1)/(exp(aRampExp)-1);
+    // set power for this step from precomputed curve
+    double f = rampCurve[rampStepNo-1];
+    double pwr = rampStartPower + (rampTargetPower-rampStartPower)*f;
+    int dir = currentDirection;
+    if (rampReversalDirection) {
+      // signed power relative to old direction
+      if (rampStepNo<=rampBrakeStart) {
+        dir = -rampReversalDirection;
+      }
+      else {
+        dir = rampReversalDirection;
+        pwr = -pwr;
+      }
+      if (pwr<0) pwr = 0; // rounding at zero crossing
+    }
+    else if (rampBend!=0) {
+      // slope correction after retargeting
+      double t = (double)rampStepNo/rampSteps;
+      pwr += rampBend*t*(1-t)*(1-t);
+      if (pwr>100) pwr = 100;
+      else if (pwr<0) pwr = 0;
     }
-    // - scale the power
-    double pwr = aStartPower + (aTargetPower-aStartPower)*f;
     LOG(LOG_DEBUG, "- f=%.3f, pwr=%.2f", f, pwr);
-    setPower(pwr, currentDirection);
+    rampSlope = pwr-currentPower;
+    if (rampReversalDirection && rampStepNo>rampBrakeStart && rampStepNo<=rampBrakeEnd) {
+      LOG(LOG_DEBUG, "- braking at %.2f%%", reversalBrakePower);
+      setBrake(reversalBrakePower);
+    }
+    else {
+      setPower(pwr, dir);
+    }
     // schedule next step
-    sequenceTicket = MainLoop::currentMainLoop().executeOnce(boost::bind(
-      &DcMotorDriver::rampStep, this, aStartPower, aTargetPower, aNumSteps, aStepNo, aRampExp, aRampDoneCB),
-      RAMP_STEP_TIME
-    );
+    rampStepDue = MainLoop::now()+rampStepTime;
+    MainLoop::currentMainLoop().executeTicketOnce(sequenceTicket, boost::bind(&DcMotorDriver::rampStep, this), rampStepTime);
+  }
+}
+
+
+#pragma mark - periodic waveforms
+
+
+void DcMotorDriver::calcSineTable(std::vector<double> &aTable, int aSize)
+{
+  aTable.resize(aSize);
+  for (int i=0; i<aSize; i++) {
+    aTable[i] = sin(2*M_PI*i/aSize);
+  }
+}
+
+
+void DcMotorDriver::runWaveform(const std::vector<double> &aTable, double aPeriod, double aMinPower, double aMaxPower, double aCrossingTime, double aStartPhase)
+{
+  stopSequences();
+  if (aTable.size()<2) return;
+  waveTable = aTable;
+  // find the peaks in both directions, for syncing
+  size_t maxI = 0, minI = 0;
+  for (size_t i=1; i<waveTable.size(); i++) {
+    if (waveTable[i]>waveTable[maxI]) maxI = i;
+    if (waveTable[i]<waveTable[minI]) minI = i;
+  }
+  wavePeakPhase[0] = (double)maxI/waveTable.size();
+  wavePeakPhase[1] = (double)minI/waveTable.size();
+  wavePhase = (uint32_t)(fmod(aStartPhase, 1)*4294967296.0);
+  setWaveformParams(aPeriod, aMinPower, aMaxPower, aCrossingTime);
+  LOG(LOG_DEBUG, "+++ new waveform: %d points, period %.3f Seconds, power %.2f%%..%.2f%%", (int)waveTable.size(), aPeriod, aMinPower, aMaxPower);
+  waveRunning = true;
+  waveStep();
+}
+
+
+void DcMotorDriver::setWaveformParams(double aPeriod, double aMinPower, double aMaxPower, double aCrossingTime)
+{
+  wavePeriod = aPeriod*Second;
+  if (wavePeriod<2*rampStepTime) wavePeriod = 2*rampStepTime;
+  wavePhaseIncrement = (uint32_t)((double)rampStepTime/wavePeriod*4294967296.0);
+  waveMinPower = aMinPower;
+  waveMaxPower = aMaxPower;
+  waveCrossingTime = aCrossingTime;
+  calcWavePowerTable();
+}
+
+
+void DcMotorDriver::calcWavePowerTable()
+{
+  // signed power for each table point: magnitude mapped to min..max, and near sign changes scaled down
+  // linearly to zero, so the power passes zero continuously within the crossing time
+  int n = (int)waveTable.size();
+  wavePowerTable.resize(n);
+  double halfCrossing = waveCrossingTime/2*Second/wavePeriod*n; // in table points
+  // distance (in table points) to the nearest sign change, both ways round the (periodic) table
+  std::vector<double> dist(n, n);
+  for (int pass=0; pass<2; pass++) {
+    double d = n;
+    for (int k=0; k<2*n; k++) {
+      int i = pass==0 ? k%n : (2*n-1-k)%n;
+      int prev = pass==0 ? (i+n-1)%n : (i+1)%n;
+      if ((waveTable[i]>=0)!=(waveTable[prev]>=0)) d = 0.5; // sign change halfway between prev and i
+      else d += 1;
+      if (d<dist[i]) dist[i] = d;
+    }
+  }
+  for (int i=0; i<n; i++) {
+    double w = waveTable[i];
+    double m = fabs(w);
+    if (m>1) m = 1;
+    double p = waveMinPower+(waveMaxPower-waveMinPower)*m;
+    if (dist[i]<halfCrossing) p *= dist[i]/halfCrossing;
+    wavePowerTable[i] = w<0 ? -p : p;
+  }
+}
+
+
+void DcMotorDriver::syncWaveformToPeak(int aDirection)
+{
+  if (!waveRunning) return;
+  wavePhase = (uint32_t)(wavePeakPhase[aDirection>0 ? 0 : 1]*4294967296.0);
+}
+
+
+void DcMotorDriver::waveStep()
+{
+  if (rampStepDue!=Never) {
+    MLMicroSeconds late = MainLoop::now()-rampStepDue;
+    rampStepLatency.add(late>0 ? late : 0);
+  }
+  // sample power table at current phase, interpolating linearly
+  int n = (int)wavePowerTable.size();
+  uint64_t pos = (uint64_t)wavePhase*n; // table position in 32.32 fixed point
+  int i = (int)(pos>>32);
+  double f = (double)(pos & 0xFFFFFFFF)/4294967296.0;
+  double pwr = wavePowerTable[i]+(wavePowerTable[(i+1)%n]-wavePowerTable[i])*f;
+  if (pwr>=0) setPower(pwr, 1);
+  else setPower(-pwr, -1);
+  if (!waveRunning) return; // stopped from output change handler
+  wavePhase += wavePhaseIncrement; // wraps around at end of period
+  // schedule next step, relative to when this step was due, so steps do not drift
+  MLMicroSeconds now = MainLoop::now();
+  if (rampStepDue==Never || rampStepDue+rampStepTime<now) rampStepDue = now;
+  rampStepDue += rampStepTime;
+  MainLoop::currentMainLoop().executeTicketOnceAt(sequenceTicket, boost::bind(&DcMotorDriver::waveStep, this), rampStepDue);
+}
+
+
+#pragma mark - position control
+
+
+void DcMotorDriver::runPositionControl(double aTarget, PositionFeedbackCB aFeedback, const PositionControlParams &aParams, DCMotorStatusCB aReachedCB)
+{
+  stopSequences();
+  if (!aFeedback) return;
+  posFeedback = aFeedback;
+  posParams = aParams;
+  posLastAngle = posFeedback();
+  LOG(LOG_DEBUG, "+++ position control: from %.1f to %.1f degrees", posLastAngle, aTarget);
+  posRunning = true;
+  setPositionTarget(aTarget, aReachedCB);
+  positionStep();
+}
+
+
+void DcMotorDriver::setPositionTarget(double aTarget, DCMotorStatusCB aReachedCB)
+{
+  posTarget = aTarget;
+  posReachedCB = aReachedCB;
+  posInToleranceSince = Never;
+}
+
+
+void DcMotorDriver::positionStep()
+{
+  MLMicroSeconds now = MainLoop::now();
+  if (rampStepDue!=Never) {
+    MLMicroSeconds late = now-rampStepDue;
+    rampStepLatency.add(late>0 ? late : 0);
   }
+  double angle = posFeedback();
+  double err = fmod(posTarget-angle, 360);
+  if (err>180) err -= 360;
+  else if (err<-180) err += 360;
+  double moved = fmod(angle-posLastAngle, 360);
+  if (moved>180) moved -= 360;
+  else if (moved<-180) moved += 360;
+  double speed = moved*Second/POSITION_CONTROL_INTERVAL;
+  posLastAngle = angle;
+  if (fabs(err)<=posParams.tolerance) {
+    // on target: motor off (the gearbox holds the arm), corrects again when pushed away
+    setPower(0, 0);
+    if (posInToleranceSince==Never) posInToleranceSince = now;
+    if (posReachedCB && now-posInToleranceSince>=posParams.settleTime) {
+      DCMotorStatusCB cb = posReachedCB;
+      posReachedCB = NULL;
+      cb(currentPower, currentDirection, ErrorPtr());
+    }
+  }
+  else {
+    // PD control, with minimum power to actually move
+    posInToleranceSince = Never;
+    double u = posParams.gain*err - posParams.damping*speed;
+    double pwr = fabs(u);
+    if (pwr>posParams.maxPower) pwr = posParams.maxPower;
+    else if (pwr<posParams.minPower) pwr = posParams.minPower;
+    setPower(pwr, u>=0 ? 1 : -1);
+  }
+  if (!posRunning) return; // stopped from output change or reached handler
+  // schedule next step at fixed rate
+  now = MainLoop::now();
+  if (rampStepDue==Never || rampStepDue+POSITION_CONTROL_INTERVAL<now) rampStepDue = now;
+  rampStepDue += POSITION_CONTROL_INTERVAL;
+  MainLoop::currentMainLoop().executeTicketOnceAt(sequenceTicket, boost::bind(&DcMotorDriver::positionStep, this), rampStepDue);
 }
 
 
+#pragma mark - sequences
+
+
 void DcMotorDriver::runSequence(SequenceStepList aSteps, DCMotorStatusCB aSequenceDoneCB)
 {
   stopSequences();
   if (aSteps.size()==0) {
     // done
     if (aSequenceDoneCB) aSequenceDoneCB(currentPower, currentDirection, ErrorPtr());
+    return;
   }
   // next step
   SequenceStep step = aSteps.front();
-  rampToPower(step.power, step.direction, step.rampTime, step.rampExp, boost::bind(&DcMotorDriver::sequenceStepDone, this, aSteps, aSequenceDoneCB, _3));
+  rampToPower(step.power, step.direction, step.rampTime, step.rampExp, boost::bind(&DcMotorDriver::sequenceStepDone, this, aSteps, aSequenceDoneCB, _3), step.profile);
 }
 
 
@@ -208,6 +716,104 @@ void DcMotorDriver::sequenceStepDone(SequenceStepList aSteps, DCMotorStatusCB aS
 }
 
 
+#pragma mark - timeline preview
+
+
+void DcMotorDriver::previewSequence(const SequenceStepList &aSteps, double aStartPower, int aStartDirection, Timeline &aTimeline)
+{
+  aTimeline.time.clear();
+  aTimeline.power.clear();
+  aTimeline.direction.clear();
+  aTimeline.brake.clear();
+  aTimeline.endPower = aStartPower;
+  aTimeline.endDirection = aStartPower>0 ? aStartDirection : 0;
+  aTimeline.endTime = 0;
+  aTimeline.truncated = false;
+  for (SequenceStepList::const_iterator pos = aSteps.begin(); pos!=aSteps.end(); ++pos) {
+    previewRamp(aTimeline, pos->power, pos->direction, pos->rampTime, pos->rampExp, pos->profile);
+    aTimeline.endTime += pos->runTime*Second;
+    if (aTimeline.truncated) break;
+  }
+}
+
+
+/// same as setPower() does to currentPower/currentDirection, recorded at endTime
+void DcMotorDriver::previewPoint(Timeline &aTimeline, double aPower, int aDirection, bool aBrake)
+{
+  if (aPower<=0) aDirection = 0;
+  aTimeline.endPower = aPower;
+  aTimeline.endDirection = aDirection;
+  if (aTimeline.time.size()>=aTimeline.maxPoints) {
+    aTimeline.truncated = true;
+    return;
+  }
+  aTimeline.time.push_back((double)aTimeline.endTime/Second);
+  aTimeline.power.push_back(aPower);
+  aTimeline.direction.push_back(aDirection);
+  aTimeline.brake.push_back(aBrake);
+}
+
+
+/// mirrors rampToPower() and rampStep() (a new ramp never retargets, as in a sequence)
+void DcMotorDriver::previewRamp(Timeline &aTimeline, double aPower, int aDirection, double aRampTime, double aRampExp, RampProfile aProfile)
+{
+  if (aPower>100) aPower=100;
+  else if (aPower<0) aPower=0;
+  double startPower = aTimeline.endPower;
+  std::vector<double> curve;
+  if (aDirection!=aTimeline.endDirection) {
+    if (startPower!=0 && aTimeline.endDirection!=0 && aDirection!=0) {
+      // reversal
+      MLMicroSeconds brakeTime = 0;
+      if (reversalBrakePower>0 && ccwDirectionOutput) brakeTime = reversalBrakeTime;
+      if (aRampTime>0) {
+        aRampTime -= (double)brakeTime/Second;
+        if (aRampTime<0) aRampTime = 0;
+        aRampTime /= 2;
+      }
+      int downSteps = rampStepsFor(startPower, aRampTime);
+      int brakeSteps = (int)(brakeTime/rampStepTime);
+      int upSteps = rampStepsFor(aPower, aRampTime);
+      int numSteps = downSteps+brakeSteps+upSteps;
+      calcReversalCurve(curve, startPower, downSteps, brakeSteps, aPower, upSteps, aRampExp, aProfile);
+      for (int i=1; i<=numSteps && !aTimeline.truncated; i++) {
+        double pwr = startPower + (-aPower-startPower)*curve[i-1];
+        int dir;
+        if (i<=downSteps) {
+          dir = -aDirection;
+        }
+        else {
+          dir = aDirection;
+          pwr = -pwr;
+        }
+        if (pwr<0) pwr = 0;
+        if (i>downSteps && i<=downSteps+brakeSteps) previewPoint(aTimeline, 0, 0, true); // setBrake() also sets power 0
+        else previewPoint(aTimeline, pwr, dir, false);
+        aTimeline.endTime += rampStepTime;
+      }
+      previewPoint(aTimeline, aPower, aDirection, false);
+      return;
+    }
+    if (startPower!=0) {
+      // down to zero first, then up in the new direction
+      if (aRampTime>0) aRampTime /= 2;
+      previewRamp(aTimeline, 0, aTimeline.endDirection, aRampTime, aRampExp, aProfile);
+      previewRamp(aTimeline, aPower, aDirection, aRampTime, aRampExp, aProfile);
+      return;
+    }
+    aTimeline.endDirection = aDirection;
+  }
+  int numSteps = rampStepsFor(aPower-startPower, aRampTime);
+  calcRampCurve(curve, numSteps, aRampExp, aProfile);
+  for (int i=1; i<=numSteps && !aTimeline.truncated; i++) {
+    previewPoint(aTimeline, startPower + (aPower-startPower)*curve[i-1], aTimeline.endDirection, false);
+    aTimeline.endTime += rampStepTime;
+  }
+  previewPoint(aTimeline, aPower, aTimeline.endDirection, false);
+}
+
+
+
 //void DcMotorDriver::runConstSequence(const SequenceStep aSteps[], DCMotorStatusCB aSequenceDoneCB)
 //{
 //  SequenceStepList steps;
@@ -24,9 +24,11 @@
 
 #include "p44utils_common.hpp"
 
-#include "serialcomm.hpp"
 #include "digitalio.hpp"
 #include "analogio.hpp"
+#include "metrics.hpp"
+
+#include <pthread.h>
 
 using namespace std;
 
@@ -40,10 +42,46 @@ namespace p44 {
 
 
   typedef boost::intrusive_ptr<DcMotorDriver> DcMotorDriverPtr;
+
+  /// @return current angle of the driven mechanism [degrees]
+  typedef boost::function<double ()> PositionFeedbackCB;
   class DcMotorDriver : public P44Obj
   {
     typedef P44Obj inherited;
 
+  public:
+
+    /// motor usage statistics
+    typedef struct {
+      double onTime[2]; ///< time motor was powered [Seconds], [0]=CW, [1]=CCW
+      double dutyTime[2]; ///< PWM duty integrated over time [full power equivalent Seconds], [0]=CW, [1]=CCW
+      long reversals; ///< number of direction reversals
+    } MotorUsage;
+
+    /// hardware output write statistics
+    typedef struct {
+      long issued; ///< number of writes actually issued to the outputs
+      long suppressed; ///< number of writes suppressed because the output already had the (quantized) value
+    } OutputWrites;
+
+    /// ramp curve profiles
+    typedef enum {
+      ramp_exp, ///< exponential curve, ramp exponent: 0=linear, + or - = logarithmic bulging up or down
+      ramp_scurve, ///< raised cosine S-curve with zero slope at both ends (bounded jerk), ramp exponent shifts the inflection point
+    } RampProfile;
+
+    /// position control loop parameters
+    typedef struct {
+      double gain; ///< proportional gain [% power per degree of error]
+      double damping; ///< derivative gain [% power per degree/Second of speed]
+      double minPower; ///< minimum driving power outside tolerance (overcomes friction and dead band) [%]
+      double maxPower; ///< maximum driving power [%]
+      double tolerance; ///< error within which the motor is off [degrees]
+      MLMicroSeconds settleTime; ///< time to stay within tolerance until the target counts as reached
+    } PositionControlParams;
+
+  private:
+
     AnalogIoPtr pwmOutput;
     DigitalIoPtr cwDirectionOutput;
     DigitalIoPtr ccwDirectionOutput;
@@ -51,7 +89,63 @@ namespace p44 {
     int currentDirection;
     double currentPower;
 
+    // shadow state of the hardware outputs, to avoid writing unchanged values
+    double pwmResolution; ///< PWM values are quantized to this resolution before writing
+    double shadowPwm; ///< last (quantized) value written to pwmOutput, <0 = unknown
+    int shadowCW; ///< last value written to cwDirectionOutput, <0 = unknown
+    int shadowCCW; ///< last value written to ccwDirectionOutput, <0 = unknown
+    bool emergencyStopped; ///< set by emergencyStop(), blocks driving until stop() is called
+    pthread_mutex_t outputMutex; ///< serializes output and shadow state access between mainloop and emergencyStop()
+    OutputWrites outputWrites;
+
     long sequenceTicket;
+    MLMicroSeconds rampStepTime;
+
+    // current ramp
+    double rampStartPower;
+    double rampTargetPower;
+    int rampSteps;
+    int rampStepNo;
+    std::vector<double> rampCurve; ///< precomputed curve (0..1) for each step of the ramp
+    double rampBend; ///< amplitude of the slope matching correction applied after retargeting
+    double rampSlope; ///< power change applied in the last step
+    bool rampRunning; ///< set while a ramp is in progress (next step scheduled)
+    int rampReversalDirection; ///< for reversal ramps: the new direction (power is signed relative to the old direction), 0 otherwise
+    int rampBrakeStart; ///< for reversal ramps: last step of the ramp down in the old direction
+    int rampBrakeEnd; ///< for reversal ramps: last step of active braking
+    DCMotorStatusCB rampDoneCB;
+    MLMicroSeconds rampStepDue; ///< when the scheduled next ramp step should execute, Never if none
+    DurationSummary rampStepLatency; ///< lateness of scheduled ramp steps
+
+    // current periodic waveform
+    std::vector<double> waveTable; ///< waveform, -1..1 for one period
+    std::vector<double> wavePowerTable; ///< signed power for each waveTable point, precomputed from waveTable and power params
+    double waveMinPower;
+    double waveMaxPower;
+    double waveCrossingTime; ///< time for crossing zero power at direction changes [Seconds]
+    MLMicroSeconds wavePeriod;
+    uint32_t wavePhase; ///< phase accumulator, full period = 2^32
+    uint32_t wavePhaseIncrement; ///< phase advance per step
+    double wavePeakPhase[2]; ///< phase (0..1) of the peak in CW [0] and CCW [1] direction
+    bool waveRunning; ///< set while a waveform is running (next step scheduled)
+
+    // current position control
+    PositionFeedbackCB posFeedback;
+    PositionControlParams posParams;
+    double posTarget; ///< [degrees]
+    double posLastAngle; ///< angle at last control step [degrees]
+    MLMicroSeconds posInToleranceSince; ///< Never if outside tolerance
+    DCMotorStatusCB posReachedCB; ///< called once when target is reached
+    bool posRunning; ///< set while the control loop is running (next step scheduled)
+
+    double reversalBrakePower; ///< active braking power applied at zero crossing of reversals, 0=none
+    MLMicroSeconds reversalBrakeTime; ///< active braking time at zero crossing of reversals
+
+    DCMotorStatusCB outputChangedCB;
+
+    MotorUsage usage; ///< usage since creation of the driver
+    MLMicroSeconds lastUsageUpdate;
+    int lastDrivingDirection; ///< last non-zero direction, to detect reversals
 
   public:
 
@@ -72,14 +166,128 @@ namespace p44 {
     /// @param aRampTime number of seconds for running this ramp.
     ///   If negative, this specifies the time for a full scale (0..100 or vice versa) power change, actual time will
     ///   be proportional to power range actually run trough.
-    ///   Note that ramping from one aDirection to another will execute two separate ramps in sequence
+    ///   Ramping from one driving aDirection to the other is executed as a single ramp down through zero and
+    ///   up again (using half of an absolute ramp time for each way), optionally with active braking at zero,
+    ///   see setReversalBrake().
+    ///   If a ramp in the same direction is already running, it is retargeted: the new ramp starts with the
+    ///   slope the running ramp currently has, and continues on the running ramp's step timing.
     /// @param aRampExp ramp exponent (0=linear, + or - = logarithmic bulging up or down)
     /// @param aRampDoneCB will be called at end of ramp
-    void rampToPower(double aPower, int aDirection, double aRampTime = 0, double aRampExp = 0, DCMotorStatusCB aRampDoneCB = NULL);
+    /// @param aProfile the ramp curve profile
+    void rampToPower(double aPower, int aDirection, double aRampTime = 0, double aRampExp = 0, DCMotorStatusCB aRampDoneCB = NULL, RampProfile aProfile = ramp_exp);
+
+    /// calculate a ramp curve
+    /// @param aCurve will receive the curve values 0..1 for step 1..aNumSteps (last value is always 1)
+    /// @param aNumSteps number of steps
+    /// @param aRampExp ramp exponent
+    /// @param aProfile ramp profile
+    static void calcRampCurve(std::vector<double> &aCurve, int aNumSteps, double aRampExp, RampProfile aProfile);
+
+    /// calculate a reversal ramp curve, down from one power to zero and up again to another power in the opposite direction
+    /// @param aCurve will receive the curve values 0..1 for step 1..aDownSteps+aBrakeSteps+aUpSteps, as fractions
+    ///   of the signed power range from aFromPower to -aToPower
+    /// @param aFromPower start power (in the old direction), >0
+    /// @param aDownSteps number of steps ramping down to zero
+    /// @param aBrakeSteps number of steps at zero (active braking)
+    /// @param aToPower end power (in the new direction)
+    /// @param aUpSteps number of steps ramping up from zero
+    /// @param aRampExp ramp exponent (applied to each of the two ramps)
+    /// @param aProfile ramp profile
+    static void calcReversalCurve(std::vector<double> &aCurve, double aFromPower, int aDownSteps, int aBrakeSteps, double aToPower, int aUpSteps, double aRampExp, RampProfile aProfile);
+
+    /// run a periodic waveform until stopped (by stop(), stopSequences() or rampToPower())
+    /// @param aTable the waveform for one period, values -1..1. The sign is the direction (+ = CW), the magnitude
+    ///   0..1 maps to aMinPower..aMaxPower. Between neighbouring values, the power is linearly interpolated.
+    /// @param aPeriod time for one full period [Seconds]
+    /// @param aMinPower power at magnitude 0 (when not crossing zero), 0..100
+    /// @param aMaxPower power at magnitude 1, 0..100
+    /// @param aCrossingTime time for power to ramp through zero (from aMinPower in one direction to the other)
+    ///   when the waveform changes its sign [Seconds]
+    /// @param aStartPhase phase to start at, 0..1
+    /// @note the waveform is sampled once per ramp step from a precomputed power table, using a phase
+    ///   accumulator, so timing does not drift and the per-step cost does not depend on the table size
+    void runWaveform(const std::vector<double> &aTable, double aPeriod, double aMinPower, double aMaxPower, double aCrossingTime, double aStartPhase = 0);
+
+    /// change the parameters of the running waveform (takes effect at the next step, phase continues)
+    /// @param aPeriod time for one full period [Seconds]
+    /// @param aMinPower power at magnitude 0, 0..100
+    /// @param aMaxPower power at magnitude 1, 0..100
+    /// @param aCrossingTime time for power to ramp through zero [Seconds]
+    void setWaveformParams(double aPeriod, double aMinPower, double aMaxPower, double aCrossingTime);
+
+    /// synchronize the waveform phase to an external event, such as detecting the midpoint of a swing
+    /// @param aDirection 1 = set phase to the peak of the CW part of the waveform, -1 = to the CCW peak
+    void syncWaveformToPeak(int aDirection);
+
+    /// @return true if a waveform is running
+    bool isWaveformRunning() { return waveRunning; };
+
+    /// calculate a sine waveform table
+    /// @param aTable will receive the sine for one period, starting at 0 (rising)
+    /// @param aSize number of table entries
+    static void calcSineTable(std::vector<double> &aTable, int aSize);
+
+    /// drive to a target angle and hold it there, with a control loop running at a fixed rate until stopped
+    /// (by stop(), stopSequences(), rampToPower(), runWaveform() or runSequence())
+    /// @param aTarget target angle [degrees]. Errors are normalized to -180..180, so the shorter way round is taken.
+    /// @param aFeedback returns the current angle
+    /// @param aParams control loop parameters
+    /// @param aReachedCB called once when the target is reached (within tolerance for the settle time)
+    void runPositionControl(double aTarget, PositionFeedbackCB aFeedback, const PositionControlParams &aParams, DCMotorStatusCB aReachedCB = NULL);
+
+    /// change the target of the running position control loop
+    /// @param aTarget new target angle [degrees]
+    /// @param aReachedCB called once when the new target is reached
+    void setPositionTarget(double aTarget, DCMotorStatusCB aReachedCB = NULL);
+
+    /// @return true if the position control loop is running
+    bool isPositionControlRunning() { return posRunning; };
+
+    /// @return target of the position control loop [degrees]
+    double getPositionTarget() { return posTarget; };
+
+    /// set active braking for direction reversals
+    /// @param aBrakePower PWM power to apply while braking (both half bridges on), 0 = no active braking
+    /// @param aBrakeTime time to brake at the zero crossing of a reversal, in seconds
+    /// @note active braking requires separate CW and CCW outputs, otherwise it is ignored
+    void setReversalBrake(double aBrakePower, double aBrakeTime);
+
+    /// set the time between steps of a ramp
+    /// @param aStepTime time per ramp step, must be >0. Default is 20mS.
+    /// @note mainly useful for benchmarking and simulation, changing it affects curve resolution, not ramp duration
+    void setRampStepTime(MLMicroSeconds aStepTime);
+
+    /// @return current power, 0..100
+    double getCurrentPower() { return currentPower; };
+
+    /// @return current direction: 1 = CW, -1 = CCW, 0 = hold/brake
+    int getCurrentDirection() { return currentDirection; };
+
+    /// set handler to be called whenever power or direction actually applied to the motor changes
+    /// @param aOutputChangedCB will be called with new power and direction (error is always NULL)
+    void setOutputChangedHandler(DCMotorStatusCB aOutputChangedCB);
+
+    /// @return usage statistics since creation of this driver, accounted up to now
+    const MotorUsage &getUsage();
+
+    /// @return lateness statistics of timer scheduled ramp steps (count = number of such steps)
+    const DurationSummary &getRampStepLatency() { return rampStepLatency; };
+
+    /// @return hardware output write statistics since creation of this driver
+    const OutputWrites &getOutputWrites() { return outputWrites; };
+
+    /// set the resolution PWM values are quantized to before writing them to the output
+    /// @param aResolution resolution in % (0..100 scale), must be >0. Default is 0.1%
+    void setPwmResolution(double aResolution);
 
     /// stop immediately, no braking
     void stop();
 
+    /// stop motor outputs immediately, callable from another thread (e.g. a watchdog) while mainloop is stalled
+    /// @note only touches the outputs, serialized with the mainloop's output writes. Blocks while the mainloop
+    ///   is in the middle of writing an output. Driving power remains blocked until stop() is called from mainloop context.
+    void emergencyStop();
+
     /// stop ramps and sequences, but do not turn off motor
     void stopSequences();
 
@@ -91,6 +299,7 @@ namespace p44 {
       double rampTime; ///< ramp speed
       double rampExp; ///< ramp exponent (0=linear, + or - = logarithmic bulging up or down)
       double runTime; ///< time to run
+      RampProfile profile; ///< ramp profile
     } SequenceStep;
 
     typedef std::list<SequenceStep> SequenceStepList;
@@ -100,6 +309,30 @@ namespace p44 {
     /// @param aSequenceDoneCB will be called at end of ramp
     void runSequence(SequenceStepList aSteps, DCMotorStatusCB aSequenceDoneCB = NULL);
 
+    /// output timeline, one point per output change as made by ramp steps
+    typedef struct {
+      std::vector<double> time; ///< time of the point, from start of the sequence [Seconds]
+      std::vector<double> power; ///< driving power 0..100 [%]
+      std::vector<int> direction; ///< 1=CW, -1=CCW, 0=off
+      std::vector<bool> brake; ///< set when braking actively (at reversalBrakePower) instead of driving
+      double endPower; ///< power at end of the timeline
+      int endDirection; ///< direction at end of the timeline
+      MLMicroSeconds endTime; ///< end of the timeline (including the last step's runTime)
+      size_t maxPoints; ///< no more points are added beyond this
+      bool truncated; ///< set if maxPoints was reached
+    } Timeline;
+
+    /// compute the output timeline runSequence() would produce, using the same ramp math, current step time
+    /// and reversal brake settings, but without touching the outputs and without using timers
+    /// @param aSteps the sequence steps
+    /// @param aStartPower assumed power at start
+    /// @param aStartDirection assumed direction at start
+    /// @param aTimeline will be filled with the timeline, set aTimeline.maxPoints before calling
+    void previewSequence(const SequenceStepList &aSteps, double aStartPower, int aStartDirection, Timeline &aTimeline);
+
+    /// @return the ramp step time
+    MLMicroSeconds getRampStepTime() { return rampStepTime; };
+
 //    /// ramp motor from current power to another power
 //    /// @param aSteps list of sequence steps, last one must have power<0 to terminate the list
 //    /// @param aSequenceDoneCB will be called at end of ramp
@@ -116,8 +349,20 @@ namespace p44 {
 
     void setPower(double aPower, int aDirection);
     void setDirection(int aDirection);
-    void rampStep(double aStartPower, double aTargetPower, int aNumSteps, int aStepNo , double aRampExp, DCMotorStatusCB aRampDoneCB);
+    void setBrake(double aBrakePower);
+    void writePwm(double aValue);
+    void writeCW(bool aOn);
+    void writeCCW(bool aOn);
+    static double rampCurvePoint(double aF, double aRampExp, double aExpNorm, RampProfile aProfile);
+    void updateUsage();
+    int rampStepsFor(double aRampRange, double aRampTime);
+    void rampStep();
+    void calcWavePowerTable();
+    void waveStep();
+    void positionStep();
     void sequenceStepDone(SequenceStepList aSteps, DCMotorStatusCB aSequenceDoneCB, ErrorPtr aError);
+    void previewRamp(Timeline &aTimeline, double aPower, int aDirection, double aRampTime, double aRampExp, RampProfile aProfile);
+    void previewPoint(Timeline &aTimeline, double aPower, int aDirection, bool aBrake);
 
 
 
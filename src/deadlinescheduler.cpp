@@ -0,0 +1,151 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "deadlinescheduler.hpp"
+
+using namespace p44;
+
+
+#define MAX_CALLS_PER_PROCESSING 100 // safety limit for callbacks setting already due deadlines again
+
+
+DeadlineScheduler::DeadlineScheduler(const char **aNames, int aNumDeadlines) :
+  timerTicket(0),
+  armedFor(Never),
+  processing(false),
+  timerArms(0),
+  deadlinesFired(0)
+{
+  deadlines.resize(aNumDeadlines);
+  for (int i=0; i<aNumDeadlines; i++) {
+    deadlines[i].name = aNames[i];
+    deadlines[i].due = Never;
+  }
+}
+
+
+DeadlineScheduler::~DeadlineScheduler()
+{
+  MainLoop::currentMainLoop().cancelExecutionTicket(timerTicket);
+}
+
+
+void DeadlineScheduler::setAt(int aId, MLMicroSeconds aWhen, SimpleCB aCallback)
+{
+  Deadline &d = deadlines[aId];
+  d.due = aWhen;
+  d.callback = aCallback;
+  LOG(LOG_DEBUG, "Deadline '%s' set, in %.3f Seconds", d.name, (double)(aWhen-MainLoop::now())/Second);
+  rearm();
+}
+
+
+void DeadlineScheduler::setIn(int aId, MLMicroSeconds aDelay, SimpleCB aCallback)
+{
+  setAt(aId, MainLoop::now()+aDelay, aCallback);
+}
+
+
+void DeadlineScheduler::cancel(int aId)
+{
+  Deadline &d = deadlines[aId];
+  if (d.due==Never) return;
+  d.due = Never;
+  d.callback = NULL;
+  rearm();
+}
+
+
+MLMicroSeconds DeadlineScheduler::nextDue()
+{
+  MLMicroSeconds next = Never;
+  for (size_t i=0; i<deadlines.size(); i++) {
+    if (deadlines[i].due!=Never && (next==Never || deadlines[i].due<next)) next = deadlines[i].due;
+  }
+  return next;
+}
+
+
+int DeadlineScheduler::processDue(MLMicroSeconds aNow)
+{
+  bool wasProcessing = processing;
+  processing = true;
+  int calls = 0;
+  while (calls<MAX_CALLS_PER_PROCESSING) {
+    // earliest due deadline
+    int earliest = -1;
+    for (size_t i=0; i<deadlines.size(); i++) {
+      const Deadline &d = deadlines[i];
+      if (d.due!=Never && d.due<=aNow && (earliest<0 || d.due<deadlines[earliest].due)) earliest = (int)i;
+    }
+    if (earliest<0) break;
+    Deadline &d = deadlines[earliest];
+    SimpleCB cb = d.callback;
+    d.due = Never;
+    d.callback = NULL;
+    LOG(LOG_DEBUG, "Deadline '%s' reached", d.name);
+    calls++;
+    deadlinesFired++;
+    if (cb) cb();
+  }
+  processing = wasProcessing;
+  rearm(); // for deadlines set by the callbacks
+  return calls;
+}
+
+
+void DeadlineScheduler::rearm()
+{
+  if (processing) return; // will be done after processing
+  MLMicroSeconds next = nextDue();
+  if (next==armedFor) return; // timer already right
+  armedFor = next;
+  if (next==Never) {
+    MainLoop::currentMainLoop().cancelExecutionTicket(timerTicket);
+    return;
+  }
+  timerArms++;
+  MainLoop::currentMainLoop().executeTicketOnceAt(timerTicket, boost::bind(&DeadlineScheduler::timerFired, this), next);
+}
+
+
+void DeadlineScheduler::timerFired()
+{
+  timerTicket = 0;
+  armedFor = Never;
+  processDue(MainLoop::now());
+}
+
+
+JsonObjectPtr DeadlineScheduler::statusAsJSON()
+{
+  JsonObjectPtr s = JsonObject::newObj();
+  JsonObjectPtr p = JsonObject::newObj();
+  MLMicroSeconds now = MainLoop::now();
+  for (size_t i=0; i<deadlines.size(); i++) {
+    const Deadline &d = deadlines[i];
+    if (d.due!=Never) p->add(d.name, JsonObject::newDouble((double)(d.due-now)/Second));
+  }
+  s->add("pending", p);
+  s->add("timerArms", JsonObject::newInt64(timerArms));
+  s->add("fired", JsonObject::newInt64(deadlinesFired));
+  return s;
+}
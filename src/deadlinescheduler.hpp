@@ -0,0 +1,99 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44wiperd__deadlinescheduler__
+#define __p44wiperd__deadlinescheduler__
+
+#include "p44utils_common.hpp"
+
+#include "jsonobject.hpp"
+
+using namespace std;
+
+namespace p44 {
+
+
+  /// A fixed set of named deadlines, served by a single mainloop timer armed for the earliest one.
+  /// Setting a deadline replaces its previous due time and callback, so re-checks scheduled from
+  /// several places collapse into one. Deadlines are identified by their index in the names array.
+  class DeadlineScheduler
+  {
+    typedef struct {
+      const char *name;
+      MLMicroSeconds due; ///< Never if not pending
+      SimpleCB callback;
+    } Deadline;
+
+    std::vector<Deadline> deadlines;
+    long timerTicket;
+    MLMicroSeconds armedFor; ///< due time the timer is currently armed for, Never if not armed
+    bool processing; ///< set while calling deadline callbacks, defers re-arming
+    long timerArms; ///< number of times the timer was (re)armed
+    long deadlinesFired;
+
+  public:
+
+    /// @param aNames names of the deadlines (for logging and status), index is the deadline id
+    /// @param aNumDeadlines number of deadlines
+    DeadlineScheduler(const char **aNames, int aNumDeadlines);
+    ~DeadlineScheduler();
+
+    /// set a deadline
+    /// @param aId the deadline
+    /// @param aWhen mainloop time when to call aCallback
+    /// @param aCallback called when the deadline is reached (once)
+    void setAt(int aId, MLMicroSeconds aWhen, SimpleCB aCallback);
+
+    /// set a deadline relative to now
+    /// @param aId the deadline
+    /// @param aDelay delay from now
+    /// @param aCallback called when the deadline is reached (once)
+    void setIn(int aId, MLMicroSeconds aDelay, SimpleCB aCallback);
+
+    /// cancel a deadline (NOP if not pending)
+    void cancel(int aId);
+
+    /// @return true if deadline is pending
+    bool isPending(int aId) { return deadlines[aId].due!=Never; };
+
+    /// @return due time of the earliest pending deadline, Never if none
+    MLMicroSeconds nextDue();
+
+    /// call all deadlines that are due at aNow (earliest first), then re-arm the timer for the remaining ones
+    /// @param aNow the time to check against
+    /// @return number of deadlines called
+    /// @note this is what the timer does; it can also be called directly with any time to test timing decisions
+    int processDue(MLMicroSeconds aNow);
+
+    /// @return pending deadlines with their remaining time [Seconds], plus timer statistics
+    JsonObjectPtr statusAsJSON();
+
+  private:
+
+    void rearm();
+    void timerFired();
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__deadlinescheduler__) */
@@ -0,0 +1,110 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "filewatcher.hpp"
+
+#include <unistd.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+using namespace p44;
+
+
+FileWatcher::FileWatcher() :
+  inotifyFd(-1)
+{
+}
+
+
+FileWatcher::~FileWatcher()
+{
+  stop();
+}
+
+
+ErrorPtr FileWatcher::watch(const string &aFilePath, SimpleCB aChangedCB)
+{
+  stop();
+  size_t i = aFilePath.rfind('/');
+  if (i==string::npos) {
+    dirPath = ".";
+    fileName = aFilePath;
+  }
+  else {
+    dirPath = i==0 ? "/" : aFilePath.substr(0, i);
+    fileName = aFilePath.substr(i+1);
+  }
+  if (fileName.empty()) return TextError::err("'%s' is not a file path", aFilePath.c_str());
+  #ifdef __linux__
+  inotifyFd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+  if (inotifyFd<0) return SysError::errNo("inotify_init: ");
+  if (inotify_add_watch(inotifyFd, dirPath.c_str(), IN_CLOSE_WRITE|IN_MOVED_TO)<0) {
+    ErrorPtr err = SysError::errNo("cannot watch directory: ");
+    close(inotifyFd);
+    inotifyFd = -1;
+    return err;
+  }
+  changedCB = aChangedCB;
+  MainLoop::currentMainLoop().registerPollHandler(inotifyFd, POLLIN, boost::bind(&FileWatcher::inotifyHandler, this, _1, _2));
+  LOG(LOG_INFO, "Watching %s for changes", aFilePath.c_str());
+  return ErrorPtr();
+  #else
+  return TextError::err("file watching needs inotify (Linux only)");
+  #endif
+}
+
+
+void FileWatcher::stop()
+{
+  if (inotifyFd>=0) {
+    MainLoop::currentMainLoop().unregisterPollHandler(inotifyFd);
+    close(inotifyFd);
+    inotifyFd = -1;
+  }
+  changedCB = NULL;
+}
+
+
+bool FileWatcher::inotifyHandler(int aFD, int aPollFlags)
+{
+  #ifdef __linux__
+  if (aPollFlags & POLLIN) {
+    // drain all pending events, report a change of our file only once
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t n;
+    while ((n = read(aFD, buf, sizeof(buf)))>0) {
+      for (char *p = buf; p<buf+n; ) {
+        struct inotify_event *ev = (struct inotify_event *)p;
+        if (ev->len>0 && fileName==ev->name) changed = true;
+        p += sizeof(struct inotify_event)+ev->len;
+      }
+    }
+    if (changed && changedCB) changedCB();
+    return true;
+  }
+  #endif
+  return false;
+}
@@ -0,0 +1,71 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __p44wiperd__filewatcher__
+#define __p44wiperd__filewatcher__
+
+#include "p44utils_common.hpp"
+
+using namespace std;
+
+namespace p44 {
+
+
+  class FileWatcher;
+  typedef boost::intrusive_ptr<FileWatcher> FileWatcherPtr;
+
+  /// Watches a single file for changes using inotify (no polling).
+  /// The containing directory is watched, so files that are replaced by rename (as most provisioning
+  /// tools and editors do) are noticed as well as files that are rewritten in place.
+  class FileWatcher : public P44Obj
+  {
+    typedef P44Obj inherited;
+
+    string dirPath;
+    string fileName;
+    int inotifyFd;
+    SimpleCB changedCB;
+
+  public:
+
+    FileWatcher();
+    virtual ~FileWatcher();
+
+    /// start watching
+    /// @param aFilePath the file to watch. The file does not need to exist yet, but its directory must.
+    /// @param aChangedCB called (from mainloop) after the file has been completely written or moved into place
+    /// @return ok or error (inotify not available, directory not accessible)
+    ErrorPtr watch(const string &aFilePath, SimpleCB aChangedCB);
+
+    /// stop watching
+    void stop();
+
+  private:
+
+    bool inotifyHandler(int aFD, int aPollFlags);
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__filewatcher__) */
@@ -0,0 +1,196 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "inputtrace.hpp"
+
+using namespace p44;
+
+
+#define TRACE_HEADER "# p44wiperd input trace v2: I <initial zeropos> <initial movement>, then <delta mS> <source Z|M|B> <value> [<changed> <mS since previous>]"
+
+
+// MARK: ===== InputTraceRecorder
+
+
+InputTraceRecorder::InputTraceRecorder() :
+  file(NULL),
+  lastEvent(Never)
+{
+}
+
+
+InputTraceRecorder::~InputTraceRecorder()
+{
+  if (file) fclose(file);
+}
+
+
+ErrorPtr InputTraceRecorder::open(const string &aFilePath, bool aZeroPos, bool aMovement)
+{
+  file = fopen(aFilePath.c_str(), "w");
+  if (!file) return SysError::errNo("cannot open input trace file for recording: ");
+  fprintf(file, "%s\n", TRACE_HEADER);
+  fprintf(file, "I %d %d\n", aZeroPos, aMovement);
+  fflush(file);
+  lastEvent = MainLoop::now();
+  return ErrorPtr();
+}
+
+
+void InputTraceRecorder::record(char aSource, int aValue, int aExtra, long aExtra2)
+{
+  if (!file) return;
+  MLMicroSeconds now = MainLoop::now();
+  if (aSource==trace_button) {
+    fprintf(file, "%lld %c %d %d %ld\n", (now-lastEvent)/MilliSecond, aSource, aValue, aExtra, aExtra2);
+  }
+  else {
+    fprintf(file, "%lld %c %d\n", (now-lastEvent)/MilliSecond, aSource, aValue);
+  }
+  fflush(file); // make sure trace survives crashes, events are rare
+  // keep rounding errors from accumulating
+  lastEvent += ((now-lastEvent)/MilliSecond)*MilliSecond;
+}
+
+
+
+// MARK: ===== InputTraceReplayer
+
+
+InputTraceReplayer::InputTraceReplayer() :
+  nextEvent(0),
+  initialZeroPos(false),
+  initialMovement(false),
+  replayTicket(0)
+{
+}
+
+
+InputTraceReplayer::~InputTraceReplayer()
+{
+  MainLoop::currentMainLoop().cancelExecutionTicket(replayTicket);
+}
+
+
+ErrorPtr InputTraceReplayer::load(const string &aFilePath)
+{
+  FILE *f = fopen(aFilePath.c_str(), "r");
+  if (!f) return SysError::errNo("cannot open input trace file: ");
+  events.clear();
+  initialZeroPos = false;
+  initialMovement = false;
+  string line;
+  int lineNo = 0;
+  ErrorPtr err;
+  while (string_fgetline(f, line)) {
+    lineNo++;
+    if (line.empty() || line[0]=='#') continue;
+    if (line[0]=='I') {
+      // initial input states (v1 traces don't have them)
+      int z, m;
+      if (sscanf(line.c_str(), "I %d %d", &z, &m)!=2) {
+        err = TextError::err("input trace line %d has invalid initial states: %s", lineNo, line.c_str());
+        break;
+      }
+      initialZeroPos = z!=0;
+      initialMovement = m!=0;
+      continue;
+    }
+    long long ms;
+    char src;
+    InputTraceEvent ev;
+    ev.extra = 0;
+    ev.extra2 = 0;
+    int n = sscanf(line.c_str(), "%lld %c %d %d %ld", &ms, &src, &ev.value, &ev.extra, &ev.extra2);
+    if (n<3 || (src!=trace_zeropos && src!=trace_movement && src!=trace_button) || (src==trace_button && n<5)) {
+      err = TextError::err("input trace line %d is invalid: %s", lineNo, line.c_str());
+      break;
+    }
+    ev.delta = ms*MilliSecond;
+    ev.source = src;
+    events.push_back(ev);
+  }
+  fclose(f);
+  return err;
+}
+
+
+void InputTraceReplayer::start(InputTraceEventCB aEventCB, SimpleCB aDoneCB)
+{
+  eventCB = aEventCB;
+  doneCB = aDoneCB;
+  nextEvent = 0;
+  scheduleNext();
+}
+
+
+void InputTraceReplayer::scheduleNext()
+{
+  if (nextEvent>=events.size()) {
+    LOG(LOG_NOTICE, "Input trace replay complete (%d events)", (int)events.size());
+    if (doneCB) doneCB();
+    return;
+  }
+  MainLoop::currentMainLoop().executeTicketOnce(replayTicket, boost::bind(&InputTraceReplayer::replayEvent, this), events[nextEvent].delta);
+}
+
+
+void InputTraceReplayer::replayEvent()
+{
+  const InputTraceEvent &ev = events[nextEvent++];
+  LOG(LOG_INFO, "Replaying input event %c %d", ev.source, ev.value);
+  if (eventCB) eventCB(ev);
+  scheduleNext();
+}
+
+
+
+// MARK: ===== MotorCommandLog
+
+
+MotorCommandLog::MotorCommandLog() :
+  file(NULL),
+  startTime(Never)
+{
+}
+
+
+MotorCommandLog::~MotorCommandLog()
+{
+  if (file) fclose(file);
+}
+
+
+ErrorPtr MotorCommandLog::open(const string &aFilePath)
+{
+  file = fopen(aFilePath.c_str(), "w");
+  if (!file) return SysError::errNo("cannot open motor command log: ");
+  fprintf(file, "# p44wiperd motor commands: <time mS> <power> <direction>\n");
+  startTime = MainLoop::now();
+  return ErrorPtr();
+}
+
+
+void MotorCommandLog::log(double aPower, int aDirection)
+{
+  if (!file) return;
+  fprintf(file, "%lld %.1f %d\n", (MainLoop::now()-startTime)/MilliSecond, aPower, aDirection);
+}
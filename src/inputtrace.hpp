@@ -0,0 +1,154 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44wiperd__inputtrace__
+#define __p44wiperd__inputtrace__
+
+#include "p44utils_common.hpp"
+
+using namespace std;
+
+namespace p44 {
+
+
+  /// input event sources in traces
+  enum {
+    trace_zeropos = 'Z', ///< zero position input, value = new state
+    trace_movement = 'M', ///< movement input, value = new state
+    trace_button = 'B' ///< button, value = state, extra = (hasChanged ? 1 : 0), extra2 = time since previous change [mS]
+  };
+
+
+  /// one recorded input event
+  typedef struct {
+    MLMicroSeconds delta; ///< time since previous event (or start of trace)
+    char source; ///< trace_xxx
+    int value;
+    int extra;
+    long extra2;
+  } InputTraceEvent;
+
+
+  /// called for each replayed event
+  typedef boost::function<void (const InputTraceEvent &aEvent)> InputTraceEventCB;
+
+
+  class InputTraceRecorder;
+  typedef boost::intrusive_ptr<InputTraceRecorder> InputTraceRecorderPtr;
+
+  /// records input events as text lines: `<delta mS> <source> <value> [<extra> <extra2>]`,
+  /// preceded by the initial input states as `I <zeropos> <movement>`
+  class InputTraceRecorder : public P44Obj
+  {
+    FILE *file;
+    MLMicroSeconds lastEvent;
+
+  public:
+
+    InputTraceRecorder();
+    virtual ~InputTraceRecorder();
+
+    /// start recording into a file (overwritten)
+    /// @param aFilePath trace file path
+    /// @param aZeroPos current state of the zero position input
+    /// @param aMovement current state of the movement input
+    ErrorPtr open(const string &aFilePath, bool aZeroPos, bool aMovement);
+
+    /// record an event (timestamped now)
+    void record(char aSource, int aValue, int aExtra = 0, long aExtra2 = 0);
+
+  };
+
+
+  class InputTraceReplayer;
+  typedef boost::intrusive_ptr<InputTraceReplayer> InputTraceReplayerPtr;
+
+  /// replays a recorded input trace through the mainloop
+  class InputTraceReplayer : public P44Obj
+  {
+    typedef std::vector<InputTraceEvent> EventVector;
+
+    EventVector events;
+    size_t nextEvent;
+    bool initialZeroPos;
+    bool initialMovement;
+    InputTraceEventCB eventCB;
+    SimpleCB doneCB;
+    long replayTicket;
+
+  public:
+
+    InputTraceReplayer();
+    virtual ~InputTraceReplayer();
+
+    /// load a trace file
+    ErrorPtr load(const string &aFilePath);
+
+    /// start replaying in real time
+    /// @param aEventCB called for every event, at its time
+    /// @param aDoneCB called after the last event
+    /// @note replay is always in real time, because motor ramps and run-time deadlines are, too.
+    void start(InputTraceEventCB aEventCB, SimpleCB aDoneCB);
+
+    /// @return number of events in the trace
+    size_t numEvents() { return events.size(); };
+
+    /// @return zero position input state at the start of the recording (false for traces without initial states)
+    bool getInitialZeroPos() { return initialZeroPos; };
+
+    /// @return movement input state at the start of the recording (false for traces without initial states)
+    bool getInitialMovement() { return initialMovement; };
+
+  private:
+
+    void scheduleNext();
+    void replayEvent();
+
+  };
+
+
+  class MotorCommandLog;
+  typedef boost::intrusive_ptr<MotorCommandLog> MotorCommandLogPtr;
+
+  /// logs motor output changes as text lines: `<time mS> <power> <direction>`, for diffing between builds
+  class MotorCommandLog : public P44Obj
+  {
+    FILE *file;
+    MLMicroSeconds startTime;
+
+  public:
+
+    MotorCommandLog();
+    virtual ~MotorCommandLog();
+
+    /// start logging into a file (overwritten)
+    /// @param aFilePath log file path
+    ErrorPtr open(const string &aFilePath);
+
+    /// log a motor output change
+    void log(double aPower, int aDirection);
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__inputtrace__) */
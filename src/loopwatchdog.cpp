@@ -0,0 +1,258 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "loopwatchdog.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+
+using namespace p44;
+
+
+#define HEARTBEAT_INTERVAL (100*MilliSecond)
+#define MONITOR_INTERVAL (50*MilliSecond)
+#define HW_WATCHDOG_DEVICE "/dev/watchdog"
+#define HW_WATCHDOG_STALL_LIMIT (2*Second) // mainloop stall after which the hardware watchdog is no longer fed
+
+// upper limits of the lateness histogram buckets, last bucket is everything above
+static const MLMicroSeconds bucketLimits[LoopWatchdog::numBuckets-1] = {
+  1*MilliSecond, 2*MilliSecond, 5*MilliSecond, 10*MilliSecond, 20*MilliSecond,
+  50*MilliSecond, 100*MilliSecond, 200*MilliSecond, 500*MilliSecond
+};
+static const char *bucketNames[LoopWatchdog::numBuckets] = {
+  "<1ms", "<2ms", "<5ms", "<10ms", "<20ms", "<50ms", "<100ms", "<200ms", "<500ms", ">=500ms"
+};
+
+
+LoopWatchdog::LoopWatchdog() :
+  hardLimit(0),
+  heartbeatTicket(0),
+  expectedBeat(Never),
+  beats(0),
+  maxLateness(0),
+  lastBeat(Never),
+  tripped(false),
+  trips(0),
+  running(false),
+  threadStarted(false),
+  hwWatchdogFd(-1)
+{
+  memset(histogram, 0, sizeof(histogram));
+  pthread_mutex_init(&mutex, NULL);
+}
+
+
+LoopWatchdog::~LoopWatchdog()
+{
+  stop();
+  pthread_mutex_destroy(&mutex);
+}
+
+
+void LoopWatchdog::start(MLMicroSeconds aHardLimit, SimpleCB aEmergencyStopCB, SimpleCB aRecoveredCB)
+{
+  if (threadStarted) return;
+  emergencyStopCB = aEmergencyStopCB;
+  recoveredCB = aRecoveredCB;
+  hardLimit = aHardLimit;
+  lastBeat = MainLoop::now();
+  expectedBeat = lastBeat+HEARTBEAT_INTERVAL;
+  MainLoop::currentMainLoop().executeTicketOnce(heartbeatTicket, boost::bind(&LoopWatchdog::heartbeat, this), HEARTBEAT_INTERVAL);
+  hwWatchdogOpen();
+  running = true;
+  if (pthread_create(&monitorThread, NULL, monitorThreadFunc, this)==0) {
+    threadStarted = true;
+  }
+  else {
+    LOG(LOG_ERR, "Watchdog: cannot start monitor thread, only collecting statistics");
+    running = false;
+  }
+}
+
+
+void LoopWatchdog::setHardLimit(MLMicroSeconds aHardLimit)
+{
+  pthread_mutex_lock(&mutex);
+  hardLimit = aHardLimit;
+  pthread_mutex_unlock(&mutex);
+}
+
+
+void LoopWatchdog::stop()
+{
+  MainLoop::currentMainLoop().cancelExecutionTicket(heartbeatTicket);
+  if (threadStarted) {
+    pthread_mutex_lock(&mutex);
+    running = false;
+    pthread_mutex_unlock(&mutex);
+    pthread_join(monitorThread, NULL);
+    threadStarted = false;
+  }
+  hwWatchdogClose();
+}
+
+
+// MARK: ===== mainloop side
+
+
+void LoopWatchdog::heartbeat()
+{
+  MLMicroSeconds now = MainLoop::now();
+  MLMicroSeconds lateness = now-expectedBeat;
+  if (lateness<0) lateness = 0;
+  int b = 0;
+  while (b<numBuckets-1 && lateness>=bucketLimits[b]) b++;
+  histogram[b]++;
+  beats++;
+  if (lateness>maxLateness) maxLateness = lateness;
+  pthread_mutex_lock(&mutex);
+  lastBeat = now;
+  bool wasTripped = tripped;
+  tripped = false;
+  pthread_mutex_unlock(&mutex);
+  if (wasTripped) {
+    LOG(LOG_ERR, "Watchdog: mainloop running again after %lld mS stall", lateness/MilliSecond);
+    if (recoveredCB) recoveredCB();
+  }
+  expectedBeat = now+HEARTBEAT_INTERVAL;
+  MainLoop::currentMainLoop().executeTicketOnce(heartbeatTicket, boost::bind(&LoopWatchdog::heartbeat, this), HEARTBEAT_INTERVAL);
+}
+
+
+JsonObjectPtr LoopWatchdog::statusAsJSON()
+{
+  JsonObjectPtr w = JsonObject::newObj();
+  w->add("beats", JsonObject::newInt64(beats));
+  w->add("maxLatency_ms", JsonObject::newDouble((double)maxLateness/MilliSecond));
+  pthread_mutex_lock(&mutex);
+  long t = trips;
+  MLMicroSeconds hl = hardLimit;
+  pthread_mutex_unlock(&mutex);
+  w->add("trips", JsonObject::newInt64(t));
+  w->add("hardLimit_ms", JsonObject::newInt64(hl/MilliSecond));
+  w->add("hwWatchdog", JsonObject::newBool(hwWatchdogFd>=0));
+  JsonObjectPtr h = JsonObject::newObj();
+  for (int i=0; i<numBuckets; i++) {
+    h->add(bucketNames[i], JsonObject::newInt64(histogram[i]));
+  }
+  w->add("latency", h);
+  return w;
+}
+
+
+// MARK: ===== monitor thread
+
+
+void *LoopWatchdog::monitorThreadFunc(void *aArg)
+{
+  static_cast<LoopWatchdog *>(aArg)->monitor();
+  return NULL;
+}
+
+
+void LoopWatchdog::monitor()
+{
+  while (true) {
+    usleep(MONITOR_INTERVAL);
+    MLMicroSeconds now = MainLoop::now();
+    pthread_mutex_lock(&mutex);
+    if (!running) {
+      pthread_mutex_unlock(&mutex);
+      break;
+    }
+    MLMicroSeconds stalled = now-lastBeat-HEARTBEAT_INTERVAL;
+    bool trip = hardLimit>0 && !tripped && stalled>hardLimit;
+    if (trip) {
+      tripped = true;
+      trips++;
+    }
+    pthread_mutex_unlock(&mutex);
+    if (trip) {
+      // Note: no logging here, logger is not thread safe
+      if (emergencyStopCB) emergencyStopCB();
+    }
+    if (stalled<=HW_WATCHDOG_STALL_LIMIT) {
+      // mainloop alive: keep hardware watchdog happy
+      // Note: independent of hardLimit, which may be 0 (never stop motor)
+      hwWatchdogFeed();
+    }
+  }
+}
+
+
+// MARK: ===== hardware watchdog
+
+#if P44_BUILD_OW
+
+void LoopWatchdog::hwWatchdogOpen()
+{
+  hwWatchdogFd = open(HW_WATCHDOG_DEVICE, O_WRONLY|O_CLOEXEC);
+  if (hwWatchdogFd<0) {
+    LOG(LOG_WARNING, "Watchdog: no hardware watchdog (%s): %s", HW_WATCHDOG_DEVICE, strerror(errno));
+  }
+  else {
+    LOG(LOG_NOTICE, "Watchdog: feeding hardware watchdog %s", HW_WATCHDOG_DEVICE);
+  }
+}
+
+
+void LoopWatchdog::hwWatchdogFeed()
+{
+  if (hwWatchdogFd>=0) {
+    if (write(hwWatchdogFd, "k", 1)<0) {
+      // nothing we can do, hardware will reset us eventually
+    }
+  }
+}
+
+
+void LoopWatchdog::hwWatchdogClose()
+{
+  if (hwWatchdogFd>=0) {
+    // magic close: disarm hardware watchdog on regular exit
+    if (write(hwWatchdogFd, "V", 1)<0) {
+      LOG(LOG_WARNING, "Watchdog: hardware watchdog magic close failed");
+    }
+    close(hwWatchdogFd);
+    hwWatchdogFd = -1;
+  }
+}
+
+#else
+
+// no hardware watchdog on generic platforms
+
+void LoopWatchdog::hwWatchdogOpen()
+{
+}
+
+
+void LoopWatchdog::hwWatchdogFeed()
+{
+}
+
+
+void LoopWatchdog::hwWatchdogClose()
+{
+}
+
+#endif // P44_BUILD_OW
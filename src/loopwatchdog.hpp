@@ -0,0 +1,112 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44wiperd__loopwatchdog__
+#define __p44wiperd__loopwatchdog__
+
+#include "p44utils_common.hpp"
+
+#include "jsonobject.hpp"
+
+#include <pthread.h>
+
+using namespace std;
+
+namespace p44 {
+
+
+  class LoopWatchdog;
+  typedef boost::intrusive_ptr<LoopWatchdog> LoopWatchdogPtr;
+
+  /// Watchdog for mainloop responsiveness.
+  /// A mainloop heartbeat timer records its lateness into a histogram. A separate monitor thread checks
+  /// that the heartbeat keeps coming, and calls an emergency stop handler (in the monitor thread!) when the
+  /// mainloop has been stalled for longer than the hard limit. The monitor thread also feeds the hardware
+  /// watchdog (on OpenWrt builds, if /dev/watchdog exists) as long as the mainloop heartbeat is not stalled
+  /// for more than a fixed limit, regardless of the hard limit.
+  class LoopWatchdog : public P44Obj
+  {
+    typedef P44Obj inherited;
+
+  public:
+
+    enum { numBuckets = 10 };
+
+  private:
+
+    MLMicroSeconds hardLimit; ///< stall time after which emergency stop is triggered, 0 = never
+    SimpleCB emergencyStopCB; ///< called from monitor thread, must only do thread safe things
+    SimpleCB recoveredCB; ///< called in mainloop context when the mainloop is running again after an emergency stop
+
+    long heartbeatTicket;
+    MLMicroSeconds expectedBeat; ///< when the current heartbeat timer should fire
+
+    // statistics (mainloop context only)
+    long beats;
+    long histogram[numBuckets]; ///< heartbeat lateness histogram, see bucketLimits
+    MLMicroSeconds maxLateness;
+
+    // shared between mainloop and monitor thread, protected by mutex
+    pthread_mutex_t mutex;
+    MLMicroSeconds lastBeat; ///< time of last heartbeat
+    bool tripped; ///< set by monitor when emergency stop was triggered
+    long trips; ///< number of emergency stops
+    bool running; ///< monitor thread should run
+
+    pthread_t monitorThread;
+    bool threadStarted;
+    int hwWatchdogFd;
+
+  public:
+
+    LoopWatchdog();
+    virtual ~LoopWatchdog();
+
+    /// start watching
+    /// @param aHardLimit mainloop stall time after which aEmergencyStopCB is called, 0 = only collect statistics
+    /// @param aEmergencyStopCB called from the monitor thread (NOT mainloop!) when the mainloop stalls
+    /// @param aRecoveredCB called in mainloop context when it runs again after an emergency stop
+    void start(MLMicroSeconds aHardLimit, SimpleCB aEmergencyStopCB, SimpleCB aRecoveredCB);
+
+    /// change the hard limit
+    void setHardLimit(MLMicroSeconds aHardLimit);
+
+    /// stop watching, ends monitor thread and properly closes the hardware watchdog
+    void stop();
+
+    /// @return statistics as JSON
+    JsonObjectPtr statusAsJSON();
+
+  private:
+
+    void heartbeat();
+    void monitor();
+    static void *monitorThreadFunc(void *aArg);
+    void hwWatchdogOpen();
+    void hwWatchdogFeed();
+    void hwWatchdogClose();
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__loopwatchdog__) */
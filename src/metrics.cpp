@@ -0,0 +1,72 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "metrics.hpp"
+
+using namespace p44;
+
+
+void DurationSummary::add(MLMicroSeconds aDuration)
+{
+  double d = (double)aDuration/Second;
+  count++;
+  sum += d;
+  if (d>max) max = d;
+}
+
+
+void MetricsText::header(const char *aName, const char *aType, const char *aHelp)
+{
+  string_format_append(out, "# HELP %s %s\n# TYPE %s %s\n", aName, aHelp, aName, aType);
+}
+
+
+void MetricsText::sample(const char *aName, double aValue, const char *aLabels)
+{
+  if (aLabels) string_format_append(out, "%s{%s} %.9g\n", aName, aLabels, aValue);
+  else string_format_append(out, "%s %.9g\n", aName, aValue);
+}
+
+
+void MetricsText::counter(const char *aName, const char *aHelp, double aValue)
+{
+  header(aName, "counter", aHelp);
+  sample(aName, aValue);
+}
+
+
+void MetricsText::gauge(const char *aName, const char *aHelp, double aValue)
+{
+  header(aName, "gauge", aHelp);
+  sample(aName, aValue);
+}
+
+
+void MetricsText::summary(const char *aName, const char *aHelp, const DurationSummary &aSummary)
+{
+  header(aName, "summary", aHelp);
+  string n = aName;
+  sample((n+"_count").c_str(), aSummary.count);
+  sample((n+"_sum").c_str(), aSummary.sum);
+  n += "_max";
+  header(n.c_str(), "gauge", "maximum of the above");
+  sample(n.c_str(), aSummary.max);
+}
@@ -0,0 +1,84 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44wiperd__metrics__
+#define __p44wiperd__metrics__
+
+#include "p44utils_common.hpp"
+
+using namespace std;
+
+namespace p44 {
+
+
+  /// fixed size summary of durations (or other values): count, sum and max
+  class DurationSummary
+  {
+  public:
+
+    long count;
+    double sum; ///< [Seconds]
+    double max; ///< [Seconds]
+
+    DurationSummary() : count(0), sum(0), max(0) {};
+
+    /// add a sample
+    /// @param aDuration duration in mainloop time units
+    void add(MLMicroSeconds aDuration);
+
+  };
+
+
+  /// helper to write metrics in Prometheus text exposition format
+  class MetricsText
+  {
+    string &out;
+
+  public:
+
+    /// @param aOut string to append metrics to
+    MetricsText(string &aOut) : out(aOut) {};
+
+    /// write HELP and TYPE header for a metric
+    /// @param aName metric name
+    /// @param aType "counter", "gauge" or "summary"
+    /// @param aHelp description
+    void header(const char *aName, const char *aType, const char *aHelp);
+
+    /// write a sample
+    /// @param aName metric name (including suffixes like _count)
+    /// @param aValue the value
+    /// @param aLabels label set without braces (like `state="3"`), or NULL
+    void sample(const char *aName, double aValue, const char *aLabels = NULL);
+
+    /// write a counter or gauge with header and one sample
+    void counter(const char *aName, const char *aHelp, double aValue);
+    void gauge(const char *aName, const char *aHelp, double aValue);
+
+    /// write a DurationSummary as summary (_count, _sum) plus a _max gauge
+    void summary(const char *aName, const char *aHelp, const DurationSummary &aSummary);
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__metrics__) */
@@ -0,0 +1,273 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "motionpatterns.hpp"
+
+using namespace p44;
+
+
+#define MAX_PATTERN_STEPS 500
+#define MAX_PATTERN_NAME_LEN 64
+
+
+// MARK: ===== MotionPattern
+
+
+static ErrorPtr getNumber(JsonObjectPtr aStep, int aStepNo, const char *aField, bool aMandatory, double aMin, double aMax, double &aValue)
+{
+  JsonObjectPtr o;
+  if (!aStep->get(aField, o)) {
+    if (aMandatory) return TextError::err("step %d: missing '%s'", aStepNo, aField);
+    return ErrorPtr();
+  }
+  if (!o->isType(json_type_double) && !o->isType(json_type_int)) {
+    return TextError::err("step %d: '%s' must be a number", aStepNo, aField);
+  }
+  aValue = o->doubleValue();
+  if (aValue<aMin || aValue>aMax) {
+    return TextError::err("step %d: '%s' must be within %g..%g", aStepNo, aField, aMin, aMax);
+  }
+  return ErrorPtr();
+}
+
+
+ErrorPtr MotionPattern::compile(JsonObjectPtr aDefinition, MotionPatternPtr &aPattern)
+{
+  ErrorPtr err;
+  JsonObjectPtr o;
+  if (!aDefinition || !aDefinition->isType(json_type_object)) {
+    return TextError::err("pattern definition must be a JSON object");
+  }
+  MotionPatternPtr p = MotionPatternPtr(new MotionPattern);
+  if (!aDefinition->get("name", o) || o->stringValue().empty()) {
+    return TextError::err("pattern needs a 'name'");
+  }
+  p->name = o->stringValue();
+  if (p->name.size()>MAX_PATTERN_NAME_LEN) {
+    return TextError::err("pattern name too long");
+  }
+  p->loop = aDefinition->get("loop", o) && o->boolValue();
+  JsonObjectPtr steps;
+  aDefinition->get("steps", steps);
+  err = compileSteps(steps, MAX_PATTERN_STEPS, p->steps);
+  if (!Error::isOK(err)) {
+    err->prefixMessage("pattern '%s': ", p->name.c_str());
+    return err;
+  }
+  p->definition = aDefinition->json_str();
+  aPattern = p;
+  return ErrorPtr();
+}
+
+
+ErrorPtr MotionPattern::compileSteps(JsonObjectPtr aStepsArray, int aMaxSteps, DcMotorDriver::SequenceStepList &aSteps)
+{
+  ErrorPtr err;
+  JsonObjectPtr o;
+  aSteps.clear();
+  if (!aStepsArray || !aStepsArray->isType(json_type_array) || aStepsArray->arrayLength()<1) {
+    return TextError::err("needs a non-empty 'steps' array");
+  }
+  if (aStepsArray->arrayLength()>aMaxSteps) {
+    return TextError::err("too many steps (max %d)", aMaxSteps);
+  }
+  for (int i=0; i<aStepsArray->arrayLength(); i++) {
+    JsonObjectPtr s = aStepsArray->arrayGet(i);
+    if (!s || !s->isType(json_type_object)) {
+      err = TextError::err("step %d: must be a JSON object", i);
+      break;
+    }
+    DcMotorDriver::SequenceStep step;
+    double d = 0;
+    if (!Error::isOK(err = getNumber(s, i, "power", true, 0, 100, step.power))) break;
+    if (!Error::isOK(err = getNumber(s, i, "direction", true, -1, 1, d))) break;
+    step.direction = d>0 ? 1 : (d<0 ? -1 : 0);
+    step.rampTime = 0;
+    if (!Error::isOK(err = getNumber(s, i, "rampTime", false, -60, 60, step.rampTime))) break;
+    step.rampExp = 0;
+    if (!Error::isOK(err = getNumber(s, i, "rampExp", false, -10, 10, step.rampExp))) break;
+    step.runTime = 0;
+    if (!Error::isOK(err = getNumber(s, i, "runTime", false, 0, 3600, step.runTime))) break;
+    step.profile = DcMotorDriver::ramp_exp;
+    if (s->get("profile", o)) {
+      string prof = o->stringValue();
+      if (prof=="scurve") step.profile = DcMotorDriver::ramp_scurve;
+      else if (prof!="exp") {
+        err = TextError::err("step %d: unknown profile '%s'", i, prof.c_str());
+        break;
+      }
+    }
+    aSteps.push_back(step);
+  }
+  return err;
+}
+
+
+
+// MARK: ===== MotionPatternLibrary
+
+
+MotionPatternLibrary::MotionPatternLibrary(ParamStore &aParamStore) :
+  paramStore(aParamStore)
+{
+}
+
+
+ErrorPtr MotionPatternLibrary::load()
+{
+  patterns.clear();
+  selectedName.clear();
+  sqlite3pp::query qry(paramStore);
+  if (qry.prepare("SELECT name, definition, selected FROM MotionPatterns")!=SQLITE_OK) {
+    return TextError::err("cannot read motion patterns: %s", paramStore.error_msg());
+  }
+  for (sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i) {
+    const char *def = i->get<const char *>(1);
+    if (!def) continue;
+    MotionPatternPtr p;
+    ErrorPtr err = MotionPattern::compile(JsonObject::objFromText(def), p);
+    if (!Error::isOK(err)) {
+      LOG(LOG_ERR, "Stored motion pattern is invalid, skipped: %s", err->description().c_str());
+      continue;
+    }
+    patterns[p->name] = p;
+    if (i->get<int>(2)) selectedName = p->name;
+  }
+  LOG(LOG_INFO, "Loaded %d motion patterns, selected: '%s'", (int)patterns.size(), selectedName.c_str());
+  return ErrorPtr();
+}
+
+
+ErrorPtr MotionPatternLibrary::define(JsonObjectPtr aDefinition)
+{
+  MotionPatternPtr p;
+  ErrorPtr err = MotionPattern::compile(aDefinition, p);
+  if (!Error::isOK(err)) return err;
+  sqlite3pp::command cmd(paramStore);
+  if (
+    cmd.prepare("INSERT OR REPLACE INTO MotionPatterns (name, definition, selected) VALUES (?, ?, ?)")!=SQLITE_OK ||
+    cmd.bind(1, p->name.c_str(), false)!=SQLITE_OK ||
+    cmd.bind(2, p->definition.c_str(), false)!=SQLITE_OK ||
+    cmd.bind(3, p->name==selectedName)!=SQLITE_OK ||
+    cmd.execute()!=SQLITE_OK
+  ) {
+    return TextError::err("cannot store motion pattern: %s", paramStore.error_msg());
+  }
+  patterns[p->name] = p;
+  LOG(LOG_NOTICE, "Defined motion pattern '%s' with %d steps", p->name.c_str(), (int)p->steps.size());
+  return ErrorPtr();
+}
+
+
+ErrorPtr MotionPatternLibrary::defineFromFile(const string &aFilePath)
+{
+  FILE *f = fopen(aFilePath.c_str(), "r");
+  if (!f) return SysError::errNo("cannot open motion pattern file: ");
+  string text;
+  string_fgetfile(f, text);
+  fclose(f);
+  JsonObjectPtr defs = JsonObject::objFromText(text.c_str());
+  if (!defs) return TextError::err("motion pattern file '%s' is not valid JSON", aFilePath.c_str());
+  if (!defs->isType(json_type_array)) return define(defs);
+  for (int i=0; i<defs->arrayLength(); i++) {
+    ErrorPtr err = define(defs->arrayGet(i));
+    if (!Error::isOK(err)) return err;
+  }
+  return ErrorPtr();
+}
+
+
+ErrorPtr MotionPatternLibrary::remove(const string &aName)
+{
+  PatternMap::iterator pos = patterns.find(aName);
+  if (pos==patterns.end()) return TextError::err("unknown motion pattern '%s'", aName.c_str());
+  sqlite3pp::command cmd(paramStore);
+  if (
+    cmd.prepare("DELETE FROM MotionPatterns WHERE name=?")!=SQLITE_OK ||
+    cmd.bind(1, aName.c_str(), false)!=SQLITE_OK ||
+    cmd.execute()!=SQLITE_OK
+  ) {
+    return TextError::err("cannot delete motion pattern: %s", paramStore.error_msg());
+  }
+  patterns.erase(pos);
+  if (aName==selectedName) selectedName.clear();
+  return ErrorPtr();
+}
+
+
+ErrorPtr MotionPatternLibrary::select(const string &aName)
+{
+  if (!aName.empty() && patterns.find(aName)==patterns.end()) {
+    return TextError::err("unknown motion pattern '%s'", aName.c_str());
+  }
+  sqlite3pp::command cmd(paramStore);
+  if (
+    cmd.prepare("UPDATE MotionPatterns SET selected=(name=?)")!=SQLITE_OK ||
+    cmd.bind(1, aName.c_str(), false)!=SQLITE_OK ||
+    cmd.execute()!=SQLITE_OK
+  ) {
+    return TextError::err("cannot select motion pattern: %s", paramStore.error_msg());
+  }
+  selectedName = aName;
+  LOG(LOG_NOTICE, "Selected motion pattern: '%s'", selectedName.c_str());
+  return ErrorPtr();
+}
+
+
+MotionPatternPtr MotionPatternLibrary::selectedPattern()
+{
+  if (selectedName.empty()) return MotionPatternPtr();
+  PatternMap::iterator pos = patterns.find(selectedName);
+  if (pos==patterns.end()) return MotionPatternPtr();
+  return pos->second;
+}
+
+
+ErrorPtr MotionPatternLibrary::processRequest(JsonObjectPtr aData, bool aIsAction, JsonObjectPtr &aResult)
+{
+  JsonObjectPtr o;
+  if (aIsAction && aData && aData->get("action", o)) {
+    // pattern actions
+    string a = o->stringValue();
+    string name;
+    if (aData->get("name", o)) name = o->stringValue();
+    if (a=="define") {
+      if (!aData->get("pattern", o)) return TextError::err("missing 'pattern'");
+      return define(o);
+    }
+    else if (a=="delete") {
+      return remove(name);
+    }
+    else if (a=="select") {
+      return select(name);
+    }
+    return TextError::err("unknown action '%s'", a.c_str());
+  }
+  // return all patterns
+  aResult = JsonObject::newObj();
+  aResult->add("selected", JsonObject::newString(selectedName));
+  JsonObjectPtr pl = JsonObject::newObj();
+  for (PatternMap::iterator pos = patterns.begin(); pos!=patterns.end(); ++pos) {
+    pl->add(pos->first.c_str(), JsonObject::objFromText(pos->second->definition.c_str()));
+  }
+  aResult->add("patterns", pl);
+  return ErrorPtr();
+}
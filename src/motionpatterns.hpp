@@ -0,0 +1,121 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44wiperd__motionpatterns__
+#define __p44wiperd__motionpatterns__
+
+#include "p44utils_common.hpp"
+
+#include "dcmotordriver.hpp"
+#include "persistentparams.hpp"
+#include "jsonobject.hpp"
+
+#include <map>
+
+using namespace std;
+
+namespace p44 {
+
+
+  class MotionPattern;
+  typedef boost::intrusive_ptr<MotionPattern> MotionPatternPtr;
+
+  /// a named motion pattern, compiled into motor driver sequence steps
+  class MotionPattern : public P44Obj
+  {
+    typedef P44Obj inherited;
+
+  public:
+
+    string name; ///< name of the pattern
+    bool loop; ///< if set, pattern is repeated as long as the wiper runs
+    DcMotorDriver::SequenceStepList steps; ///< the compiled steps
+    string definition; ///< JSON source text, as stored
+
+    /// compile a pattern from its JSON definition
+    /// @param aDefinition JSON object of the form
+    ///   { "name":"xy", "loop":true, "steps":[ { "power":60, "direction":1, "rampTime":0.5, "rampExp":-1.85, "runTime":0, "profile":"exp" }, ... ] }
+    ///   power and direction are mandatory for each step, others default to 0 resp. "exp" ("scurve" is the other profile)
+    /// @param aPattern will be set to the compiled pattern
+    /// @return ok or error describing why the definition is invalid
+    static ErrorPtr compile(JsonObjectPtr aDefinition, MotionPatternPtr &aPattern);
+
+    /// compile a JSON array of steps (as in a pattern's "steps") into sequence steps
+    /// @param aStepsArray the JSON array
+    /// @param aMaxSteps max number of steps allowed
+    /// @param aSteps will be set to the compiled steps
+    /// @return ok or error describing the first invalid step
+    static ErrorPtr compileSteps(JsonObjectPtr aStepsArray, int aMaxSteps, DcMotorDriver::SequenceStepList &aSteps);
+
+  };
+
+
+  /// library of motion patterns, persisted in the settings database
+  class MotionPatternLibrary
+  {
+    typedef std::map<string, MotionPatternPtr> PatternMap;
+
+    ParamStore &paramStore;
+    PatternMap patterns;
+    string selectedName; ///< name of the selected pattern, empty for built-in swing
+
+  public:
+
+    MotionPatternLibrary(ParamStore &aParamStore);
+
+    /// load and compile all patterns from the database
+    /// @note patterns that no longer compile are skipped (and logged)
+    ErrorPtr load();
+
+    /// define (add or replace) a pattern
+    /// @param aDefinition the JSON definition, see MotionPattern::compile()
+    /// @return ok or error
+    ErrorPtr define(JsonObjectPtr aDefinition);
+
+    /// define all patterns found in a JSON file
+    /// @param aFilePath path of a file containing a single pattern definition or an array of them
+    /// @return ok or error
+    ErrorPtr defineFromFile(const string &aFilePath);
+
+    /// delete a pattern
+    /// @param aName name of the pattern
+    ErrorPtr remove(const string &aName);
+
+    /// select the pattern to use for swinging
+    /// @param aName name of the pattern, empty to use built-in swing
+    ErrorPtr select(const string &aName);
+
+    /// @return selected pattern, NULL if built-in swing is selected
+    MotionPatternPtr selectedPattern();
+
+    /// process a "patterns" API request
+    /// @param aData the request data (can be NULL for plain reads)
+    /// @param aIsAction true if request is an action (write)
+    /// @param aResult will be set to the result object, if any
+    /// @return ok or error
+    ErrorPtr processRequest(JsonObjectPtr aData, bool aIsAction, JsonObjectPtr &aResult);
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__motionpatterns__) */
@@ -0,0 +1,84 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "motorsimulator.hpp"
+
+#include <math.h>
+
+using namespace p44;
+
+
+#define DEFAULT_DEADBAND 10 // [%]
+#define DEFAULT_TIME_CONSTANT 0.15 // [Seconds]
+#define DEFAULT_ZERO_WIDTH 6 // [degrees]
+
+
+MotorSimulator::MotorSimulator() :
+  angle(0),
+  speed(0)
+{
+  params = defaultParams(4, 100);
+}
+
+
+MotorSimulator::Params MotorSimulator::defaultParams(double aRotationTime, double aPower)
+{
+  Params p;
+  p.deadbandPower = DEFAULT_DEADBAND;
+  p.timeConstant = DEFAULT_TIME_CONSTANT;
+  p.zeroWidth = DEFAULT_ZERO_WIDTH;
+  double effective = aPower-p.deadbandPower;
+  p.degreesPerSecondPerPercent = aRotationTime>0 && effective>0 ? 360/aRotationTime/effective : 1;
+  return p;
+}
+
+
+void MotorSimulator::reset(double aAngle)
+{
+  angle = aAngle;
+  speed = 0;
+}
+
+
+void MotorSimulator::step(double aTimeStep, double aPower, int aDirection)
+{
+  double target = 0;
+  if (aDirection!=0 && aPower>params.deadbandPower) {
+    target = aDirection*(aPower-params.deadbandPower)*params.degreesPerSecondPerPercent;
+  }
+  if (params.timeConstant>0) {
+    speed += (target-speed)*(1-exp(-aTimeStep/params.timeConstant));
+  }
+  else {
+    speed = target;
+  }
+  angle += speed*aTimeStep;
+  angle = fmod(angle+180, 360);
+  if (angle<0) angle += 360;
+  angle -= 180;
+}
+
+
+bool MotorSimulator::zeroInput()
+{
+  return fabs(angle)<=params.zeroWidth/2;
+}
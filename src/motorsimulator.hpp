@@ -0,0 +1,92 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __p44wiperd__motorsimulator__
+#define __p44wiperd__motorsimulator__
+
+#include "p44utils_common.hpp"
+
+using namespace std;
+
+namespace p44 {
+
+
+  /// Simple model of the motor and wiper arm, for running things without hardware.
+  /// Speed follows the applied power with a first order lag, nothing moves below a deadband power,
+  /// and the zero position input is active within a small angle around 0 degrees.
+  /// Pure computation, no mainloop or IO involved, so it can run in any thread and faster than real time.
+  class MotorSimulator
+  {
+  public:
+
+    typedef struct {
+      double degreesPerSecondPerPercent; ///< steady state speed per power above deadband
+      double deadbandPower; ///< power below which the arm does not move [%]
+      double timeConstant; ///< speed lag [Seconds]
+      double zeroWidth; ///< width of the zero position signal [degrees]
+    } Params;
+
+  private:
+
+    Params params;
+    double angle; ///< [degrees], normalized to -180..180
+    double speed; ///< [degrees/Second], signed
+
+  public:
+
+    MotorSimulator();
+
+    /// set model parameters
+    void setParams(const Params &aParams) { params = aParams; };
+
+    /// @return model parameters
+    const Params &getParams() { return params; };
+
+    /// set defaults derived from a calibration measurement
+    /// @param aRotationTime time for one full rotation at aPower [Seconds]
+    /// @param aPower the power aRotationTime was measured at, 0..100
+    static Params defaultParams(double aRotationTime, double aPower);
+
+    /// put the arm at a position, at rest
+    void reset(double aAngle = 0);
+
+    /// advance the model
+    /// @param aTimeStep time step [Seconds]
+    /// @param aPower applied power 0..100
+    /// @param aDirection applied direction 1=CW, -1=CCW, 0=off
+    void step(double aTimeStep, double aPower, int aDirection);
+
+    /// @return true if the zero position input would be active now
+    bool zeroInput();
+
+    /// @return current angle [degrees], -180..180
+    double currentAngle() { return angle; };
+
+    /// @return current speed [degrees/Second], signed
+    double currentSpeed() { return speed; };
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__motorsimulator__) */
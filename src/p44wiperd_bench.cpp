@@ -0,0 +1,322 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "application.hpp"
+
+#include "dcmotordriver.hpp"
+#include "wipersettings.hpp"
+
+#include <sys/resource.h>
+
+
+using namespace p44;
+
+#define MAINLOOP_CYCLE_TIME_uS 10000 // 10mS
+#define DEFAULT_DBDIR "/tmp"
+#define DEFAULT_ITERATIONS 1000
+#define DEFAULT_DB_ITERATIONS 50
+#define BENCH_RAMP_STEP_TIME (1*MicroSecond) // step as fast as mainloop allows, to measure cost, not timing
+
+
+/// Microbenchmarks for the performance relevant parts of p44wiperd, using mock IO
+/// Results are written to stdout as one JSON object per line
+class P44WiperBench : public CmdLineApp
+{
+  typedef CmdLineApp inherited;
+
+  WiperParamStore benchStore; ///< separate database, does not touch real settings
+  WiperSettingsParams settings;
+
+  DcMotorDriverPtr motorDriver;
+
+  int iterations;
+  int dbIterations;
+
+  MLMicroSeconds startTime;
+  double startCpu;
+
+public:
+
+  P44WiperBench() :
+    settings(benchStore),
+    iterations(DEFAULT_ITERATIONS),
+    dbIterations(DEFAULT_DB_ITERATIONS),
+    startTime(Never),
+    startCpu(0)
+  {
+  }
+
+
+  virtual int main(int argc, char **argv)
+  {
+    const char *usageText =
+      "Usage: %1$s [options]\n";
+    const CmdLineOptionDescriptor options[] = {
+      { 'n', "iterations",     true,  "count;number of iterations for in-memory benchmarks (default=1000)" },
+      { 0  , "dbiterations",   true,  "count;number of iterations for SQLite benchmarks (default=50)" },
+      { 's', "sqlitedir",      true,  "dirpath;set SQLite DB directory for bench DB (default = " DEFAULT_DBDIR ")" },
+      { 'l', "loglevel",       true,  "level;set max level of log message detail to show on stderr" },
+      { 'h', "help",           false, "show this text" },
+      { 0, NULL } // list terminator
+    };
+
+    // parse the command line, exits when syntax errors occur
+    setCommandDescriptors(usageText, options);
+    parseCommandLine(argc, argv);
+
+    if (getOption("help") || numArguments()>0) {
+      // show usage
+      showUsage();
+      terminateApp(EXIT_SUCCESS);
+    }
+
+    // build objects only if not terminated early
+    if (!isTerminated()) {
+      int loglevel = LOG_ERR; // keep stdout clean for results
+      getIntOption("loglevel", loglevel);
+      SETLOGLEVEL(loglevel);
+      SETERRLEVEL(loglevel, false);
+      getIntOption("iterations", iterations);
+      if (iterations<1) iterations = 1;
+      getIntOption("dbiterations", dbIterations);
+      if (dbIterations<1) dbIterations = 1;
+      // - bench settings DB, always fresh
+      string benchdb = DEFAULT_DBDIR;
+      getStringOption("sqlitedir", benchdb);
+      pathstring_format_append(benchdb, "WiperBench.sqlite3");
+      ErrorPtr err = benchStore.connectAndInitialize(benchdb.c_str(), WIPERPARAMS_SCHEMA_VERSION, WIPERPARAMS_SCHEMA_MIN_VERSION, true);
+      if (!Error::isOK(err)) {
+        err->prefixMessage("Cannot create bench DB: ");
+        terminateAppWith(err);
+      }
+      // - motor driver with mock outputs
+      motorDriver = DcMotorDriverPtr(new DcMotorDriver("missing", "missing", "missing"));
+      motorDriver->setRampStepTime(BENCH_RAMP_STEP_TIME);
+    } // if !terminated
+    // app now ready to run (or cleanup when already terminated)
+    return run();
+  }
+
+
+  virtual void initialize()
+  {
+    settingsBenchmarks();
+    persistenceBenchmarks();
+    previewBenchmark();
+    // timed benchmarks need the mainloop
+    rampBenchmark();
+  }
+
+
+  // MARK: ===== measurement
+
+
+  static double cpuSeconds()
+  {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return
+      ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+      (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)/1E6;
+  }
+
+
+  void startMeasuring()
+  {
+    startCpu = cpuSeconds();
+    startTime = MainLoop::now();
+  }
+
+
+  void report(const char *aBenchmark, long aOperations)
+  {
+    MLMicroSeconds elapsed = MainLoop::now()-startTime;
+    double cpu = cpuSeconds()-startCpu;
+    JsonObjectPtr r = JsonObject::newObj();
+    r->add("benchmark", JsonObject::newString(aBenchmark));
+    r->add("operations", JsonObject::newInt64(aOperations));
+    r->add("total_us", JsonObject::newInt64(elapsed));
+    r->add("ns_per_op", JsonObject::newDouble((double)elapsed*1000/aOperations));
+    r->add("cpu_ns_per_op", JsonObject::newDouble(cpu*1E9/aOperations));
+    fprintf(stdout, "%s\n", r->c_strValue());
+    fflush(stdout);
+  }
+
+
+  // MARK: ===== settings access
+
+
+  void settingsBenchmarks()
+  {
+    JsonObjectPtr res;
+    // fieldAsJSON
+    startMeasuring();
+    for (int n=0; n<iterations; n++) {
+      for (int i=0; i<numSettingsFields; i++) {
+        res = settings.fieldAsJSON(settingsFieldDefs[i]);
+      }
+    }
+    report("fieldAsJSON", (long)iterations*numSettingsFields);
+    // JSONtoField
+    vector<JsonObjectPtr> values;
+    for (int i=0; i<numSettingsFields; i++) {
+      values.push_back(settings.fieldAsJSON(settingsFieldDefs[i]));
+    }
+    startMeasuring();
+    for (int n=0; n<iterations; n++) {
+      for (int i=0; i<numSettingsFields; i++) {
+        settings.JSONtoField(settingsFieldDefs[i], values[i]);
+      }
+    }
+    report("JSONtoField", (long)iterations*numSettingsFields);
+    // processRequest: read all
+    startMeasuring();
+    for (int n=0; n<iterations; n++) {
+      settings.processRequest(JsonObjectPtr(), false, res);
+    }
+    report("processRequest_readAll", iterations);
+    // processRequest: read single field
+    JsonObjectPtr rd = JsonObject::newObj();
+    rd->add("field", JsonObject::newString("swingPeriod"));
+    startMeasuring();
+    for (int n=0; n<iterations; n++) {
+      settings.processRequest(rd, true, res);
+    }
+    report("processRequest_readField", iterations);
+    // processRequest: write single field
+    JsonObjectPtr wr = JsonObject::newObj();
+    wr->add("field", JsonObject::newString("swingPeriod"));
+    wr->add("value", JsonObject::newDouble(settings.swingPeriod));
+    startMeasuring();
+    for (int n=0; n<iterations; n++) {
+      settings.processRequest(wr, true, res);
+    }
+    report("processRequest_writeField", iterations);
+  }
+
+
+  // MARK: ===== persistence
+
+
+  void persistenceBenchmarks()
+  {
+    // saveToStore (always dirty, so each save actually writes)
+    startMeasuring();
+    for (int n=0; n<dbIterations; n++) {
+      settings.saveChanges();
+    }
+    report("saveToStore", dbIterations);
+    // loadFromStore
+    startMeasuring();
+    for (int n=0; n<dbIterations; n++) {
+      settings.load();
+    }
+    report("loadFromStore", dbIterations);
+  }
+
+
+  // MARK: ===== motor driver
+
+
+  void previewBenchmark()
+  {
+    // a sequence of `iterations` steps, each a ramp of 25 steps
+    DcMotorDriver::SequenceStepList steps;
+    for (int n=0; n<iterations; n++) {
+      DcMotorDriver::SequenceStep step;
+      step.power = n & 1 ? 30 : 80;
+      step.direction = n & 2 ? -1 : 1;
+      step.rampTime = 0.5;
+      step.rampExp = -1.85;
+      step.runTime = 0;
+      step.profile = DcMotorDriver::ramp_exp;
+      steps.push_back(step);
+    }
+    DcMotorDriver::Timeline tl;
+    tl.maxPoints = (size_t)iterations*100;
+    motorDriver->setRampStepTime(20*MilliSecond);
+    startMeasuring();
+    motorDriver->previewSequence(steps, 0, 0, tl);
+    report("previewSequence_step", iterations);
+    motorDriver->setRampStepTime(BENCH_RAMP_STEP_TIME);
+  }
+
+
+  void rampBenchmark()
+  {
+    motorDriver->stop();
+    startMeasuring();
+    // one ramp with exactly `iterations` steps
+    motorDriver->rampToPower(100, 1, (double)(iterations*BENCH_RAMP_STEP_TIME)/Second, -1.85, boost::bind(&P44WiperBench::rampBenchmarkDone, this));
+  }
+
+
+  void rampBenchmarkDone()
+  {
+    report("rampStep", iterations+1); // ramp has a final step
+    sequenceBenchmark();
+  }
+
+
+  void sequenceBenchmark()
+  {
+    motorDriver->stop();
+    DcMotorDriver::SequenceStepList steps;
+    for (int n=0; n<iterations; n++) {
+      DcMotorDriver::SequenceStep step;
+      step.power = n & 1 ? 50 : 60;
+      step.direction = 1;
+      step.rampTime = 0;
+      step.rampExp = 0;
+      step.runTime = 0;
+      step.profile = DcMotorDriver::ramp_exp;
+      steps.push_back(step);
+    }
+    startMeasuring();
+    motorDriver->runSequence(steps, boost::bind(&P44WiperBench::sequenceBenchmarkDone, this));
+  }
+
+
+  void sequenceBenchmarkDone()
+  {
+    report("runSequence_step", iterations);
+    motorDriver->stop();
+    terminateApp(EXIT_SUCCESS);
+  }
+
+};
+
+
+// MARK: ===== main
+
+
+int main(int argc, char **argv)
+{
+  // prevent debug output before application.main scans command line
+  SETLOGLEVEL(LOG_EMERG);
+  SETERRLEVEL(LOG_EMERG, false); // messages, if any, go to stderr
+  // create the mainloop
+  MainLoop::currentMainLoop().setLoopCycleTime(MAINLOOP_CYCLE_TIME_uS);
+  // create app with current mainloop
+  static P44WiperBench application;
+  // pass control
+  return application.main(argc, argv);
+}
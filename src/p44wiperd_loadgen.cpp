@@ -0,0 +1,357 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "application.hpp"
+
+#include "jsoncomm.hpp"
+
+#include <algorithm>
+
+
+using namespace std;
+using namespace p44;
+
+#define MAINLOOP_CYCLE_TIME_uS 10000 // 10mS
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_CLIENTS 10
+#define DEFAULT_REQUESTS 1000
+#define DEFAULT_URIS "settings,status"
+#define DEFAULT_OPACTION "auto"
+#define DEFAULT_APILOGLEVEL 5
+#define REQUEST_TIMEOUT (5*Second)
+
+
+/// Load generator for the p44wiperd JSON API.
+/// Runs a number of concurrent clients, each doing one request per connection (as the daemon closes
+/// connections after each answer), and reports throughput, latency percentiles, errors and the ramp
+/// step lateness the daemon observed while under load, as one JSON object on stdout
+class P44WiperLoadGen : public CmdLineApp
+{
+  typedef CmdLineApp inherited;
+
+  typedef struct {
+    JsonCommPtr conn; ///< current connection, NULL when idle
+    MLMicroSeconds started; ///< when the current request was started
+    long timeoutTicket;
+  } ClientSlot;
+
+  typedef enum {
+    phase_before, ///< getting daemon status before load
+    phase_load, ///< generating load
+    phase_after ///< getting daemon status after load
+  } Phase;
+
+  string host;
+  string port;
+  int numClients;
+  int numRequests;
+  vector<string> uris;
+  string opAction;
+  int apiLogLevel;
+
+  Phase phase;
+  vector<ClientSlot> slots;
+  int requestsStarted;
+  int requestsDone;
+  vector<MLMicroSeconds> latencies;
+  long connectErrors;
+  long errorAnswers;
+  long timeouts;
+  MLMicroSeconds loadStart;
+  MLMicroSeconds loadEnd;
+  JsonObjectPtr statusBefore;
+  JsonObjectPtr statusAfter;
+
+public:
+
+  P44WiperLoadGen() :
+    host(DEFAULT_HOST),
+    numClients(DEFAULT_CLIENTS),
+    numRequests(DEFAULT_REQUESTS),
+    opAction(DEFAULT_OPACTION),
+    apiLogLevel(DEFAULT_APILOGLEVEL),
+    phase(phase_before),
+    requestsStarted(0),
+    requestsDone(0),
+    connectErrors(0),
+    errorAnswers(0),
+    timeouts(0),
+    loadStart(Never),
+    loadEnd(Never)
+  {
+  }
+
+
+  virtual int main(int argc, char **argv)
+  {
+    const char *usageText =
+      "Usage: %1$s [options]\n";
+    const CmdLineOptionDescriptor options[] = {
+      { 0  , "host",           true,  "host;p44wiperd host (default=" DEFAULT_HOST ")" },
+      { 0  , "jsonapiport",    true,  "port;p44wiperd JSON API port" },
+      { 'c', "clients",        true,  "count;number of concurrent clients (default=10)" },
+      { 'n', "requests",       true,  "count;total number of requests (default=1000)" },
+      { 0  , "uris",           true,  "uri,...;API URIs to request round robin: settings, status, usage, metrics, log, operation (default=" DEFAULT_URIS ")" },
+      { 0  , "opaction",       true,  "action;action to send with operation requests (default=" DEFAULT_OPACTION ")" },
+      { 0  , "apiloglevel",    true,  "level;log level to send with log requests (default=5)" },
+      { 'l', "loglevel",       true,  "level;set max level of log message detail to show on stderr" },
+      { 'h', "help",           false, "show this text" },
+      { 0, NULL } // list terminator
+    };
+
+    // parse the command line, exits when syntax errors occur
+    setCommandDescriptors(usageText, options);
+    parseCommandLine(argc, argv);
+
+    if (getOption("help") || numArguments()>0 || !getStringOption("jsonapiport", port)) {
+      // show usage
+      showUsage();
+      terminateApp(EXIT_SUCCESS);
+    }
+
+    // build objects only if not terminated early
+    if (!isTerminated()) {
+      int loglevel = LOG_ERR; // keep stdout clean for results
+      getIntOption("loglevel", loglevel);
+      SETLOGLEVEL(loglevel);
+      SETERRLEVEL(loglevel, false);
+      getStringOption("host", host);
+      getIntOption("clients", numClients);
+      if (numClients<1) numClients = 1;
+      getIntOption("requests", numRequests);
+      if (numRequests<1) numRequests = 1;
+      getStringOption("opaction", opAction);
+      getIntOption("apiloglevel", apiLogLevel);
+      string u = DEFAULT_URIS;
+      getStringOption("uris", u);
+      const char *p = u.c_str();
+      string uri;
+      while (nextPart(p, uri, ',')) {
+        if (!uri.empty()) uris.push_back(uri);
+      }
+      if (uris.empty()) uris.push_back("status");
+      // fixed memory during the run
+      slots.resize(numClients);
+      for (int i=0; i<numClients; i++) {
+        slots[i].started = Never;
+        slots[i].timeoutTicket = 0;
+      }
+      latencies.reserve(numRequests);
+    } // if !terminated
+    // app now ready to run (or cleanup when already terminated)
+    return run();
+  }
+
+
+  virtual void initialize()
+  {
+    // status before load, as baseline for ramp step lateness
+    startRequest(0, "status", JsonObjectPtr());
+  }
+
+
+  // MARK: ===== requests
+
+
+  JsonObjectPtr loadRequestFor(int aRequestNo, string &aUri)
+  {
+    aUri = uris[aRequestNo % uris.size()];
+    JsonObjectPtr data;
+    if (aUri=="operation") {
+      data = JsonObject::newObj();
+      data->add("action", JsonObject::newString(opAction));
+    }
+    else if (aUri=="log") {
+      data = JsonObject::newObj();
+      data->add("level", JsonObject::newInt32(apiLogLevel));
+    }
+    return data;
+  }
+
+
+  /// start a request on a client slot, using the same mg44-style envelope the web server wrapper uses
+  void startRequest(int aSlot, const string &aUri, JsonObjectPtr aData)
+  {
+    JsonObjectPtr req = JsonObject::newObj();
+    req->add("method", JsonObject::newString(aData ? "POST" : "GET"));
+    req->add("uri", JsonObject::newString(aUri));
+    if (aData) req->add("data", aData);
+    ClientSlot &s = slots[aSlot];
+    s.conn = JsonCommPtr(new JsonComm(MainLoop::currentMainLoop()));
+    s.conn->setConnectionParams(host.c_str(), port.c_str(), SOCK_STREAM, AF_INET);
+    s.conn->setMessageHandler(boost::bind(&P44WiperLoadGen::answerReceived, this, aSlot, s.conn, _1, _2));
+    s.conn->setConnectionStatusHandler(boost::bind(&P44WiperLoadGen::connectionStatus, this, aSlot, req, _1, _2));
+    s.conn->setClearHandlersAtClose();
+    s.started = MainLoop::now();
+    MainLoop::currentMainLoop().executeTicketOnce(s.timeoutTicket, boost::bind(&P44WiperLoadGen::requestTimeout, this, aSlot), REQUEST_TIMEOUT);
+    ErrorPtr err = s.conn->initiateConnection();
+    if (!Error::isOK(err)) {
+      connectionStatus(aSlot, req, s.conn, err);
+    }
+  }
+
+
+  void connectionStatus(int aSlot, JsonObjectPtr aRequest, SocketCommPtr aSocketComm, ErrorPtr aError)
+  {
+    ClientSlot &s = slots[aSlot];
+    if (s.conn!=aSocketComm) return; // stale, request already done
+    if (Error::isOK(aError)) {
+      // connected, send request
+      s.conn->sendMessage(aRequest);
+      return;
+    }
+    LOG(LOG_INFO, "client %d: connection error: %s", aSlot, aError->description().c_str());
+    connectErrors++;
+    requestEnded(aSlot, false);
+  }
+
+
+  void answerReceived(int aSlot, JsonCommPtr aConn, ErrorPtr aError, JsonObjectPtr aAnswer)
+  {
+    ClientSlot &s = slots[aSlot];
+    if (s.conn!=aConn) return; // stale
+    JsonObjectPtr o;
+    if (!Error::isOK(aError) || !aAnswer || aAnswer->get("Error", o)) {
+      LOG(LOG_INFO, "client %d: error answer: %s", aSlot, aAnswer ? aAnswer->c_strValue() : aError->description().c_str());
+      errorAnswers++;
+      requestEnded(aSlot, false);
+      return;
+    }
+    if (phase==phase_before) statusBefore = aAnswer;
+    else if (phase==phase_after) statusAfter = aAnswer;
+    requestEnded(aSlot, true);
+  }
+
+
+  void requestTimeout(int aSlot)
+  {
+    slots[aSlot].timeoutTicket = 0;
+    LOG(LOG_INFO, "client %d: timeout", aSlot);
+    timeouts++;
+    requestEnded(aSlot, false);
+  }
+
+
+  void requestEnded(int aSlot, bool aOK)
+  {
+    ClientSlot &s = slots[aSlot];
+    MainLoop::currentMainLoop().cancelExecutionTicket(s.timeoutTicket);
+    JsonCommPtr conn = s.conn;
+    s.conn.reset(); // makes further callbacks from this connection stale
+    if (conn) conn->closeConnection();
+    switch (phase) {
+      case phase_before:
+        // start load
+        phase = phase_load;
+        loadStart = MainLoop::now();
+        for (int i=0; i<numClients && requestsStarted<numRequests; i++) nextLoadRequest(i);
+        break;
+      case phase_load:
+        if (aOK) latencies.push_back(MainLoop::now()-s.started);
+        requestsDone++;
+        if (requestsStarted<numRequests) {
+          nextLoadRequest(aSlot);
+        }
+        else if (requestsDone>=numRequests) {
+          // all done, status after load
+          loadEnd = MainLoop::now();
+          phase = phase_after;
+          startRequest(0, "status", JsonObjectPtr());
+        }
+        break;
+      case phase_after:
+        report();
+        terminateApp(EXIT_SUCCESS);
+        break;
+    }
+  }
+
+
+  void nextLoadRequest(int aSlot)
+  {
+    string uri;
+    JsonObjectPtr data = loadRequestFor(requestsStarted++, uri);
+    startRequest(aSlot, uri, data);
+  }
+
+
+  // MARK: ===== report
+
+
+  MLMicroSeconds percentile(double aFraction)
+  {
+    if (latencies.empty()) return 0;
+    size_t i = (size_t)(aFraction*(latencies.size()-1)+0.5);
+    return latencies[i];
+  }
+
+
+  void report()
+  {
+    sort(latencies.begin(), latencies.end());
+    JsonObjectPtr r = JsonObject::newObj();
+    r->add("clients", JsonObject::newInt32(numClients));
+    r->add("requests", JsonObject::newInt32(numRequests));
+    r->add("ok", JsonObject::newInt64(latencies.size()));
+    r->add("connectErrors", JsonObject::newInt64(connectErrors));
+    r->add("errorAnswers", JsonObject::newInt64(errorAnswers));
+    r->add("timeouts", JsonObject::newInt64(timeouts));
+    double elapsed = (double)(loadEnd-loadStart)/Second;
+    r->add("elapsed_s", JsonObject::newDouble(elapsed));
+    r->add("requests_per_s", JsonObject::newDouble(elapsed>0 ? latencies.size()/elapsed : 0));
+    r->add("p50_us", JsonObject::newInt64(percentile(0.5)));
+    r->add("p99_us", JsonObject::newInt64(percentile(0.99)));
+    r->add("max_us", JsonObject::newInt64(percentile(1)));
+    // ramp step lateness in the daemon during the load period
+    JsonObjectPtr b, a, o;
+    if (statusBefore && statusAfter && statusBefore->get("rampStepLatency", b) && statusAfter->get("rampStepLatency", a)) {
+      long long steps = a->get("count", o) ? o->int64Value() : 0;
+      double sum = a->get("sum", o) ? o->doubleValue() : 0;
+      if (b->get("count", o)) steps -= o->int64Value();
+      if (b->get("sum", o)) sum -= o->doubleValue();
+      JsonObjectPtr j = JsonObject::newObj();
+      j->add("steps", JsonObject::newInt64(steps));
+      j->add("mean_late_us", JsonObject::newDouble(steps>0 ? sum*1E6/steps : 0));
+      if (a->get("max", o)) j->add("max_late_us", JsonObject::newDouble(o->doubleValue()*1E6)); // since daemon start, not only during load
+      r->add("rampStepLatency", j);
+    }
+    fprintf(stdout, "%s\n", r->c_strValue());
+    fflush(stdout);
+  }
+
+};
+
+
+// MARK: ===== main
+
+
+int main(int argc, char **argv)
+{
+  // prevent debug output before application.main scans command line
+  SETLOGLEVEL(LOG_EMERG);
+  SETERRLEVEL(LOG_EMERG, false); // messages, if any, go to stderr
+  // create the mainloop
+  MainLoop::currentMainLoop().setLoopCycleTime(MAINLOOP_CYCLE_TIME_uS);
+  // create app with current mainloop
+  static P44WiperLoadGen application;
+  // pass control
+  return application.main(argc, argv);
+}
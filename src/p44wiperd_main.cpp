@@ -22,9 +22,21 @@
 #include "application.hpp"
 
 #include "jsoncomm.hpp"
-#include "persistentparams.hpp"
 
 #include "dcmotordriver.hpp"
+#include "positionestimator.hpp"
+#include "wipersettings.hpp"
+#include "motionpatterns.hpp"
+#include "weeklyschedule.hpp"
+#include "loopwatchdog.hpp"
+#include "metrics.hpp"
+#include "inputtrace.hpp"
+#include "swingtuner.hpp"
+#include "deadlinescheduler.hpp"
+#include "characterizer.hpp"
+#include "statusblock.hpp"
+#include "filewatcher.hpp"
+#include "motorsimulator.hpp"
 
 
 using namespace p44;
@@ -32,268 +44,44 @@ using namespace p44;
 #define MAINLOOP_CYCLE_TIME_uS 10000 // 10mS
 #define DEFAULT_LOGLEVEL LOG_NOTICE
 #define DEFAULT_DBDIR "/tmp"
+#define DEFAULT_API_MAX_CONNECTIONS 3
+#define DEFAULT_API_MAX_CONNECTIONS_STR "3"
+#define DEFAULT_STATUSBLOCK "/dev/shm/p44wiperd.status"
 
+#define MIN_POSITION_CONFIDENCE 0.3 // below this, position estimate is not used for decisions
+#define STARTUP_CONFIDENCE_FACTOR 0.5 // arm might have been moved by hand while off
+#define ZERO_SEARCH_MARGIN 20 // [degrees] extra travel beyond estimated zero position before searching other side
+#define MIDPOINT_MARGIN 10 // [degrees] extra travel beyond estimated midpoint before simulating it
+#define SINE_TABLE_SIZE 256 // points per period of the sine swing waveform
 
+#define USAGE_CHECKPOINT_INTERVAL (15*Minute) // how often lifetime usage counters are saved (if changed)
 
-// MARK: ===== settings definitions
+#define MAX_POSITIONING_TIME (20*Second) // positioning operation fails when target is not reached within this time
+#define POSITION_SETTLE_TIME (200*MilliSecond) // time within tolerance until a target counts as reached
+#define SIM_STEP_INTERVAL (5*MilliSecond) // motor simulation step, also zero position input sampling
 
-#define FIELD(ty,f) ((ty*)settings. )
+#define MAX_PREVIEW_STEPS 10000 // max sequence steps in a timeline preview request
+#define MAX_PREVIEW_CYCLES 100 // max swing cycles in a timeline preview request
+#define MAX_PREVIEW_POINTS 25000 // timeline preview is truncated beyond this (a 1000 step sequence fits), keeps the mainloop responsive
 
+// API endpoints, for per-endpoint request counting (unknown ones are counted as "other")
+static const char *apiEndpoints[] = { "settings", "status", "usage", "patterns", "schedule", "log", "operation", "metrics", "preview", "other" };
+static const int numApiEndpoints = sizeof(apiEndpoints)/sizeof(const char *);
 
-typedef struct {
-  const char *fieldName;
-  const char *title;
-  json_type jsonType;
-  size_t offset;
-  double min;
-  double max;
-  double res;
-  double def;
-} SettingsFieldDef;
-
-
-enum {
-  wiper_mechanical = 0,
-  wiper_software = 1
-};
-
-
-#define OFFS(fld) offsetof(WiperSettings, fld)
-#define FLD(ty,offs) (*((ty*)(((char *)&settings)+offs)))
-
-typedef struct {
-  int initialMode; ///< initial run mode
-  int wiperType; ///< initial run mode
-  double calibratePower; ///< calibration power [%]
-  double calibrateRotationTime; ///< time a full rotation takes at calibration power [Seconds]
-  double rezeroSwingAngle; ///< max rezero swing from initial position [degrees]
-  double findZeroRamp; ///< full power ramp time during zero position find [Seconds]
-  double swingMaxPower; ///< swing max power [%]
-  double swingMinPower; ///< swing min power [%]
-  double swingPeriod; ///< swing period [seconds]
-  double swingCurveExp; ///< swing power curve exponent, -1.85 is near sine wave
-  double midPointAdjustTime; ///< midpoint adjust ramp time [Seconds]
-  double midPointSearchTime; ///< max time waiting for midpoint after swingdown ramp [Seconds]
-  double dirChangeTime; ///< time for changing direction [Seconds]
-  double runTimeAfterMovement; ///< how long wiper runs after detecting movement [Seconds]
-  double maxRunTime; ///< how long wiper will run totally (including retriggers) [Seconds]
-  double pauseTime; ///< how long wiper will not trigger again after a completed movement phase [Seconds]
-  double haltTime; // full ramp time when halting wiper [Seconds]",
-} WiperSettings;
-
-
-static const SettingsFieldDef settingsFieldDefs[] = {
-  {
-    .fieldName = "initialMode",
-    .title =  "Initial mode after startup: 0=off, 1=auto, 2=on",
-    .jsonType = json_type_int,
-    .offset = OFFS(initialMode),
-    .min = 0,
-    .max = 2,
-    .res = 1,
-    .def = 0 // off
-  },
-  {
-    .fieldName = "wiperType",
-    .title =  "Type of wiper motor: 0=mechanical wiper, 1=just motor with software controlled wiping",
-    .jsonType = json_type_int,
-    .offset = OFFS(wiperType),
-    .min = 0,
-    .max = 1,
-    .res = 1,
-    .def = wiper_software // new wiper with software wiping
-  },
-  {
-    .fieldName = "calibratePower",
-    .title =  "Motor power for calibration runs [%]",
-    .jsonType = json_type_double,
-    .offset = OFFS(calibratePower),
-    .min = 20,
-    .max = 100,
-    .res = 1,
-    .def = 80 // moderate
-  },
-  {
-    .fieldName = "calibrateRotationTime",
-    .title =  "Time for one full rotation [seconds]",
-    .jsonType = json_type_double,
-    .offset = OFFS(calibrateRotationTime),
-    .min = 1,
-    .max = 10,
-    .res = 0.05,
-    .def = 3 // measured @ 80% power
-  },
-  {
-    .fieldName = "rezeroSwingAngle",
-    .title =  "Max angle to move left or right for rezeroing [degrees]",
-    .jsonType = json_type_double,
-    .offset = OFFS(rezeroSwingAngle),
-    .min = 30,
-    .max = 200,
-    .res = 1,
-    .def = 90 // half circle max
-  },
-  {
-    .fieldName = "findZeroRamp",
-    .title =  "Full power ramp time during zero position find [seconds]",
-    .jsonType = json_type_double,
-    .offset = OFFS(findZeroRamp),
-    .min = 0,
-    .max = 1,
-    .res = 0.05,
-    .def = 0.1 // not too sudden start+stop
-  },
-  {
-    .fieldName = "swingMaxPower",
-    .title =  "Swing max power [%] (also for mechanical wiper type)",
-    .jsonType = json_type_double,
-    .offset = OFFS(swingMaxPower),
-    .min = 0,
-    .max = 100,
-    .res = 1,
-    .def = 80 // moderate
-  },
-  {
-    .fieldName = "swingMinPower",
-    .title =  "Swing min power [%]",
-    .jsonType = json_type_double,
-    .offset = OFFS(swingMinPower),
-    .min = 0,
-    .max = 100,
-    .res = 1,
-    .def = 70 // almost off
-  },
-  {
-    .fieldName = "swingPeriod",
-    .title =  "Swing period [seconds]",
-    .jsonType = json_type_double,
-    .offset = OFFS(swingPeriod),
-    .min = 0,
-    .max = 2,
-    .res = 0.02,
-    .def = 0.3 // one swing time
-  },
-  {
-    .fieldName = "swingCurveExp",
-    .title =  "Swing power curve exponent, -1.85 is near sine wave",
-    .jsonType = json_type_double,
-    .offset = OFFS(swingCurveExp),
-    .min = -5,
-    .max = 5,
-    .res = 0.05,
-    .def = -1.85 // near sine
-  },
-  {
-    .fieldName = "midPointAdjustTime",
-    .title =  "Midpoint adjust ramp time [Seconds]",
-    .jsonType = json_type_double,
-    .offset = OFFS(midPointAdjustTime),
-    .min = 0,
-    .max = 1,
-    .res = 0.02,
-    .def = 0.1 // quick
-  },
-  {
-    .fieldName = "midPointSearchTime",
-    .title =  "Max time waiting for midpoint after swingdown ramp, 0=forever [Seconds]",
-    .jsonType = json_type_double,
-    .offset = OFFS(midPointSearchTime),
-    .min = 0,
-    .max = 10,
-    .res = 0.1,
-    .def = 1 // not too long
-  },
-  {
-    .fieldName = "dirChangeTime",
-    .title =  "Time for changing direction [Seconds]",
-    .jsonType = json_type_double,
-    .offset = OFFS(dirChangeTime),
-    .min = 0,
-    .max = 5,
-    .res = 0.05,
-    .def = 0.2 // not too long
-  },
-  {
-    .fieldName = "runTimeAfterMovement",
-    .title =  "How long wiper runs after detecting movement [Seconds]",
-    .jsonType = json_type_double,
-    .offset = OFFS(runTimeAfterMovement),
-    .min = 5,
-    .max = 300,
-    .res = 1,
-    .def = 15 // a bit
-  },
-  {
-    .fieldName = "maxRunTime",
-    .title =  "How long wiper will run totally (including retriggers) [Seconds]",
-    .jsonType = json_type_double,
-    .offset = OFFS(maxRunTime),
-    .min = 5,
-    .max = 3600,
-    .res = 5,
-    .def = 30 // a bit more
-  },
-  {
-    .fieldName = "pauseTime",
-    .title =  "How long wiper will pause after completed movement [Seconds]",
-    .jsonType = json_type_double,
-    .offset = OFFS(pauseTime),
-    .min = 5,
-    .max = 1800,
-    .res = 5,
-    .def = 10 // a bit
-  },
-  {
-    .fieldName = "haltTime",
-    .title =  "Full ramp time when halting wiper (or starting mechanical wiper) [Seconds]",
-    .jsonType = json_type_double,
-    .offset = OFFS(haltTime),
-    .min = 0,
-    .max = 4,
-    .res = 0.05,
-    .def = 0.4 // a bit
-  },
-};
-
-static int numSettingsFields = sizeof(settingsFieldDefs)/sizeof(SettingsFieldDef);
-
+// wiper run-time deadlines, all served by one timer
+typedef enum {
+  dl_triggerExpiry, ///< auto mode: run time after last movement trigger ends
+  dl_maxRun, ///< auto mode: total run time ends
+  dl_pauseEnd, ///< auto mode: pause after a run ends
+  dl_preArm, ///< auto mode: pre-arming starts or ends
+  dl_midpointFallback, ///< swing: simulate midpoint when not detected in time
+  dl_operation, ///< timeout of the current operation
+  numDeadlines
+} DeadlineId;
+static const char *deadlineNames[numDeadlines] = { "triggerExpiry", "maxRun", "pauseEnd", "preArm", "midpointFallback", "operation" };
 
 
 
-
-// MARK: ===== settimgs DB database
-
-
-// Version history
-//  1 : initial version
-#define WIPERPARAMS_SCHEMA_VERSION 1 // minimally supported version, anything older will be deleted
-#define WIPERPARAMS_SCHEMA_MIN_VERSION 1 // current version
-
-/// persistence for digitalSTROM paramters
-class WiperParamStore : public ParamStore
-{
-  typedef SQLite3Persistence inherited;
-protected:
-
-  /// Get DB Schema creation/upgrade SQL statements
-  string dbSchemaUpgradeSQL(int aFromVersion, int &aToVersion)
-  {
-    string sql;
-    if (aFromVersion==0) {
-      // create DB from scratch
-      // - use standard globs table for schema version
-      sql = inherited::dbSchemaUpgradeSQL(aFromVersion, aToVersion);
-      // - no vdchost level table to create at this time
-      //   (PersistentParams create and update their tables as needed)
-      // reached final version in one step
-      aToVersion = WIPERPARAMS_SCHEMA_VERSION;
-    }
-    return sql;
-  }
-
-};
-
-
 // MARK: ===== Application
 
 
@@ -301,21 +89,40 @@ typedef boost::function<void (JsonObjectPtr aResponse, ErrorPtr aError)> Request
 
 
 /// Main program for plan44.ch P44-DSB-DEH in form of the "vdcd" daemon)
-class P44WiperD : public CmdLineApp, public PersistentParams
+class P44WiperD : public CmdLineApp
 {
   typedef CmdLineApp inherited;
-  typedef PersistentParams inheritedParams;
 
   // API Server
   SocketCommPtr apiServer;
+  SocketCommPtr metricsServer;
+  StatusBlockPublisherPtr statusBlock; ///< shared memory status for local consumers
 
   // Motor driver
   DcMotorDriverPtr motorDriver;
   DigitalIoPtr zeroPosInput;
+  PositionEstimatorPtr positionEstimator;
+  LoopWatchdogPtr watchdog;
 
   // Movement sensor
   DigitalIoPtr movementInput;
 
+  // input trace recording/replay
+  InputTraceRecorderPtr inputRecorder;
+  InputTraceReplayerPtr inputReplayer;
+  MotorCommandLogPtr motorLog;
+  bool replayedZeroPos; ///< zero position input state as replayed
+  bool replayedMovement; ///< movement input state as replayed
+
+  // motor simulation
+  bool simulateMotor; ///< set if motor and zero position input are simulated
+  MotorSimulator motorSim;
+  bool simulatedZeroPos; ///< zero position input state as simulated
+  double simPower; ///< power applied to the simulated motor
+  int simDirection; ///< direction applied to the simulated motor
+  MLMicroSeconds simLastStep;
+  long simTicket;
+
   // LED+Button
   ButtonInputPtr button;
   IndicatorOutputPtr greenLed;
@@ -323,17 +130,25 @@ class P44WiperD : public CmdLineApp, public PersistentParams
 
   // settings
   WiperParamStore settingsStore; ///< the database for storing settings persistently
-  WiperSettings settings; ///< the settings variables
+  WiperSettingsParams settings; ///< the settings variables
+  WiperRunState runState; ///< state saved at clean shutdown
+  string settingsFilePath; ///< externally provisioned settings file, empty if none
+  FileWatcherPtr settingsFileWatcher;
+  MotionPatternLibrary patterns; ///< the motion patterns
+  WeeklySchedule schedule; ///< operating mode schedule
+  SwingTuner swingTuner; ///< automatic swing parameter tuning
+  std::vector<double> sineWaveform; ///< waveform for swingCurveType 2
+  std::vector<double> userWaveform; ///< waveform for swingCurveType 3, empty if none defined
+  int trustedMvState; ///< movement state from last clean shutdown, mv_unknown if none
 
   MLMicroSeconds starttime;
   MLMicroSeconds lastZeroPosTime;
-  long midPointSimTicket;
-  long mechModeCheckTicket;
-  long extraCheckSwingTicket;
-  long opTicket;
+  DeadlineScheduler deadlines; ///< all wiper run-time timeouts
+  RampCharacterizerPtr characterizer;
   StatusCB opDoneCB;
+  double zeroSearchFirstLeg; ///< travel [degrees] of first leg of zero search
 
-  enum {
+  typedef enum {
     mv_unknown,
     mv_busy,
     mv_calibrate_find_zero,
@@ -341,45 +156,96 @@ class P44WiperD : public CmdLineApp, public PersistentParams
     mv_return_zero_cw,
     mv_return_zero_ccw,
     mv_return_zero_more_ccw,
+    mv_return_zero_more_cw,
     mv_zeroed,
     mv_swing_cw_before_zero,
     mv_swing_cw_after_zero,
     mv_swing_ccw_before_zero,
-    mv_swing_ccw_after_zero
-  } mvState;
+    mv_swing_ccw_after_zero,
+    mv_pattern,
+    mv_position,
+    mv_numStates
+  } MvState;
+  MvState mvState;
 
 
   typedef enum {
     run_off,
     run_auto,
-    run_always
+    run_always,
+    run_position ///< holding a target angle (set via API), not swinging
   } RunMode;
   RunMode runMode;
 
   bool swinging;
+  bool preArmed; ///< holding idle power, ready for a quick swing start
+  RunMode autotuneRestoreMode; ///< run mode to return to after autotune
   MLMicroSeconds runUntil;
   MLMicroSeconds lastSwingChange;
 
+  // usage accounting
+  long sessionSwingCycles;
+  long sessionCalibrations;
+  DcMotorDriver::MotorUsage motorUsageBase; ///< lifetime motor usage at startup
+  long long swingCyclesBase; ///< lifetime swing cycles at startup
+  long long calibrationsBase; ///< lifetime calibrations at startup
+  double checkpointedActivity; ///< sum of all session counters at last checkpoint, to detect changes
+  long usageCheckpointTicket;
+
+  // metrics (fixed memory, cheap to update and to scrape)
+  MLMicroSeconds mvStateSince; ///< when mvState was entered
+  MLMicroSeconds timeInState[mv_numStates]; ///< accumulated time in each mvState (excluding current period)
+  long movementTriggers;
+  MLMicroSeconds zeroFindStart;
+  long zeroFindFailures;
+  DurationSummary zeroFindTimes; ///< durations of successful zero finds
+  long apiRequests[numApiEndpoints];
+  DurationSummary apiLatency;
+
 
 
 public:
 
   P44WiperD() :
-    inheritedParams(settingsStore),
+    replayedZeroPos(false),
+    replayedMovement(false),
+    simulateMotor(false),
+    simulatedZeroPos(false),
+    simPower(0),
+    simDirection(0),
+    simLastStep(Never),
+    simTicket(0),
+    settings(settingsStore),
+    runState(settingsStore),
+    patterns(settingsStore),
+    schedule(settingsStore, run_always),
+    swingTuner(settings),
+    trustedMvState(mv_unknown),
     starttime(MainLoop::now()),
     mvState(mv_unknown),
     runMode(run_off),
-    opTicket(0),
-    midPointSimTicket(0),
-    mechModeCheckTicket(0),
-    extraCheckSwingTicket(0),
     lastZeroPosTime(Never),
+    deadlines(deadlineNames, numDeadlines),
+    zeroSearchFirstLeg(0),
     swinging(false),
+    preArmed(false),
+    autotuneRestoreMode(run_off),
     lastSwingChange(Never),
-    runUntil(Never)
-  {
-    // default settings
-    default_settings();
+    runUntil(Never),
+    sessionSwingCycles(0),
+    sessionCalibrations(0),
+    swingCyclesBase(0),
+    calibrationsBase(0),
+    checkpointedActivity(0),
+    usageCheckpointTicket(0),
+    mvStateSince(MainLoop::now()),
+    movementTriggers(0),
+    zeroFindStart(Never),
+    zeroFindFailures(0)
+  {
+    memset(&motorUsageBase, 0, sizeof(motorUsageBase));
+    memset(timeInState, 0, sizeof(timeInState));
+    memset(apiRequests, 0, sizeof(apiRequests));
   }
 
 
@@ -390,6 +256,10 @@ public:
     const CmdLineOptionDescriptor options[] = {
       { 0  , "jsonapiport",    true,  "port;server port number for JSON API (default=none)" },
       { 0  , "jsonapinonlocal",false, "allow JSON API from non-local clients" },
+      { 0  , "apimaxconnections",true, "count;max number of concurrent JSON API connections (default=" DEFAULT_API_MAX_CONNECTIONS_STR ")" },
+      { 0  , "metricsport",    true,  "port;server port number for plain text (Prometheus) metrics (default=none)" },
+      { 0  , "statusblock",    true,  "path;publish status in shared memory file for local readers (usually " DEFAULT_STATUSBLOCK ", default=none)" },
+      { 0  , "settingsfile",   true,  "jsonfile;apply settings from this file at startup and whenever it changes" },
       { 's', "sqlitedir",      true,  "dirpath;set SQLite DB directory (default = " DEFAULT_DBDIR ")" },
       { 'l', "loglevel",       true,  "level;set max level of log message detail to show on stdout" },
       { 0  , "errlevel",       true,  "level;set max level for log messages to go to stderr as well" },
@@ -403,6 +273,22 @@ public:
       { 0  , "greenled",       true,  "output pinspec; green device LED" },
       { 0  , "redled",         true,  "output pinspec; red device LED" },
       { 0  , "calibrate",      false, "measure one rotation at full speed and adjust setting" },
+      { 0  , "patterns",       true,  "jsonfile;define motion patterns from JSON file (single pattern or array of patterns)" },
+      { 0  , "waveform",       true,  "jsonfile;user swing waveform (swingCurveType 3): JSON array of values -1..1 for one period" },
+      { 0  , "recordinputs",   true,  "tracefile;record zero position, movement and button input events to trace file" },
+      { 0  , "replayinputs",   true,  "tracefile;replay input events from trace file in real time instead of using the real inputs, motor outputs are mocked" },
+      { 0  , "replayexit",     false, "terminate when --replayinputs trace is complete" },
+      { 0  , "simulatemotor",  true,  "angle;simulate motor and zero position input instead of using the hardware, arm starting at angle [degrees]" },
+      { 0  , "motorlog",       true,  "logfile;log all motor output changes to file" },
+      // characterization
+      { 0  , "characterize",   true,  "csvfile;run a grid of ramps, write commanded power and zero position events to CSV, then exit" },
+      { 0  , "charpowers",     true,  "list;comma separated target powers for --characterize (default=40,60,80,100)" },
+      { 0  , "charramps",      true,  "list;comma separated ramp times [Seconds] for --characterize (default=0,0.5,1)" },
+      { 0  , "charexps",       true,  "list;comma separated ramp exponents for --characterize (default=0)" },
+      { 0  , "charhold",       true,  "seconds;time to hold target power for --characterize (default=3)" },
+      { 0  , "charsample",     true,  "mS;zero input sampling interval (hardware) or time step (simulator) for --characterize (default=1)" },
+      { 0  , "simulate",       false, "run --characterize on the motor simulator instead of the hardware" },
+      { 0  , "charthreads",    true,  "count;number of threads for simulated --characterize (default=number of CPUs)" },
       // experimental
       { 0  , "power",          true,  "float;end-of-rampp power, 0..100" },
       { 0  , "initialpower",   true,  "float;initial power, 0..100" },
@@ -441,36 +327,134 @@ public:
       ErrorPtr err = settingsStore.connectAndInitialize(settingsdb.c_str(), WIPERPARAMS_SCHEMA_VERSION, WIPERPARAMS_SCHEMA_MIN_VERSION, false);
       if (Error::isOK(err)) {
         // load the settings
-        err = load();
+        err = settings.load();
       }
       if (!Error::isOK(err)) {
         err->prefixMessage("Cannot load persistent settings: ");
         terminateAppWith(err);
       }
+      // - externally provisioned settings
+      if (getStringOption("settingsfile", settingsFilePath)) {
+        int changed;
+        err = settings.applyFile(settingsFilePath, changed);
+        if (!Error::isOK(err)) LOG(LOG_WARNING, "Settings file not applied: %s", err->description().c_str());
+        settingsFileWatcher = FileWatcherPtr(new FileWatcher);
+        err = settingsFileWatcher->watch(settingsFilePath, boost::bind(&P44WiperD::settingsFileChanged, this));
+        if (!Error::isOK(err)) terminateAppWith(err);
+      }
 
       // - show settings
-      logParams();
+      settings.logParams();
+      // - simulated characterization blocks until done and needs no hardware: run it before any outputs
+      //   are created or the watchdog starts, and exit
+      string csvpath;
+      if (getOption("simulate") && getStringOption("characterize", csvpath)) {
+        terminateAppWith(characterize(csvpath));
+        return run();
+      }
+      // - motion patterns
+      err = patterns.load();
+      string patternfile;
+      if (Error::isOK(err) && getStringOption("patterns", patternfile)) {
+        err = patterns.defineFromFile(patternfile);
+      }
+      if (!Error::isOK(err)) {
+        LOG(LOG_ERR, "Motion patterns: %s", err->description().c_str());
+      }
+      // - swing waveforms
+      DcMotorDriver::calcSineTable(sineWaveform, SINE_TABLE_SIZE);
+      string waveformfile;
+      if (getStringOption("waveform", waveformfile)) {
+        err = loadWaveform(waveformfile);
+        if (!Error::isOK(err)) {
+          LOG(LOG_ERR, "Waveform: %s", err->description().c_str());
+        }
+      }
+      // - operating schedule
+      err = schedule.load();
+      if (!Error::isOK(err)) {
+        LOG(LOG_ERR, "Schedule: %s", err->description().c_str());
+      }
+      // - check for state saved at clean shutdown
+      if (Error::isOK(runState.load()) && runState.cleanShutdown) {
+        trustedMvState = runState.lastMvState;
+        LOG(LOG_INFO, "Clean shutdown state available, mvState was %d", trustedMvState);
+      }
+      // - lifetime usage counters so far
+      motorUsageBase.onTime[0] = runState.motorOnTimeCW;
+      motorUsageBase.onTime[1] = runState.motorOnTimeCCW;
+      motorUsageBase.dutyTime[0] = runState.motorDutyTimeCW;
+      motorUsageBase.dutyTime[1] = runState.motorDutyTimeCCW;
+      motorUsageBase.reversals = runState.motorReversals;
+      swingCyclesBase = runState.swingCycles;
+      calibrationsBase = runState.calibrations;
+      // - from now on, saved state is invalid until next clean shutdown
+      runState.cleanShutdown = false;
+      runState.save();
+
+      // - input trace replay
+      string tracefile;
+      if (getStringOption("replayinputs", tracefile)) {
+        inputReplayer = InputTraceReplayerPtr(new InputTraceReplayer);
+        err = inputReplayer->load(tracefile);
+        if (!Error::isOK(err)) terminateAppWith(err);
+        replayedZeroPos = inputReplayer->getInitialZeroPos();
+        replayedMovement = inputReplayer->getInitialMovement();
+        LOG(LOG_NOTICE, "Replaying %d input events from '%s' against mock motor outputs", (int)inputReplayer->numEvents(), tracefile.c_str());
+      }
+      if (getStringOption("motorlog", tracefile)) {
+        motorLog = MotorCommandLogPtr(new MotorCommandLog);
+        err = motorLog->open(tracefile);
+        if (!Error::isOK(err)) terminateAppWith(err);
+      }
 
       // - create button input
       button = ButtonInputPtr(new ButtonInput(getOption("button","missing")));
-      button->setButtonHandler(boost::bind(&P44WiperD::buttonHandler, this, _1, _2, _3), true, Second);
+      if (!inputReplayer) button->setButtonHandler(boost::bind(&P44WiperD::buttonHandler, this, _1, _2, _3), true, Second);
       // - create LEDs
       greenLed = IndicatorOutputPtr(new IndicatorOutput(getOption("greenled","missing")));
       redLed = IndicatorOutputPtr(new IndicatorOutput(getOption("redled","missing")));
 
-      // - create motor driver
+      // - create motor driver (never on real outputs when replaying a trace)
       motorDriver = DcMotorDriverPtr(new DcMotorDriver(
-        getOption("poweroutput","missing"),
-        getOption("cwoutput","missing"),
-        getOption("ccwoutput","missing")
+        inputReplayer ? "missing" : getOption("poweroutput","missing"),
+        inputReplayer ? "missing" : getOption("cwoutput","missing"),
+        inputReplayer ? "missing" : getOption("ccwoutput","missing")
       ));
+      // - create position estimator, fed by motor driver output changes
+      positionEstimator = PositionEstimatorPtr(new PositionEstimator);
+      positionEstimator->setCalibration(settings.calibrateRotationTime, settings.calibratePower);
+      if (trustedMvState!=mv_unknown) {
+        positionEstimator->setEstimate(runState.lastAngle, runState.lastAngleConfidence*STARTUP_CONFIDENCE_FACTOR);
+      }
+      motorDriver->setReversalBrake(settings.reversalBrakePower, settings.reversalBrakeTime);
+      motorDriver->setOutputChangedHandler(boost::bind(&P44WiperD::motorOutputChanged, this, _1, _2));
+      // - create mainloop watchdog
+      watchdog = LoopWatchdogPtr(new LoopWatchdog);
       // - create zero position input
       zeroPosInput = DigitalIoPtr(new DigitalIo(getOption("zeroposinput","missing"), false, false));
-      zeroPosInput->setInputChangedHandler(boost::bind(&P44WiperD::zeroPosHandler, this, _1), 40*MilliSecond, 0);
+      string simangle;
+      if (!inputReplayer && getStringOption("simulatemotor", simangle)) {
+        double a = 0;
+        sscanf(simangle.c_str(), "%lf", &a);
+        simulateMotor = true;
+        motorSim.setParams(MotorSimulator::defaultParams(settings.calibrateRotationTime, settings.calibratePower));
+        motorSim.reset(a);
+        simulatedZeroPos = motorSim.zeroInput();
+        LOG(LOG_NOTICE, "Simulating motor, arm starting at %.1f degrees", a);
+      }
+      else if (!inputReplayer) zeroPosInput->setInputChangedHandler(boost::bind(&P44WiperD::zeroPosHandler, this, _1), 40*MilliSecond, 0);
 
       // movement detector input
       movementInput = DigitalIoPtr(new DigitalIo(getOption("movementinput","missing"), false, false));
-      movementInput->setInputChangedHandler(boost::bind(&P44WiperD::movementHandler, this, _1), 0, 0);
+      if (!inputReplayer) movementInput->setInputChangedHandler(boost::bind(&P44WiperD::movementHandler, this, _1), 0, 0);
+
+      // - input trace recording, starting with the current input states
+      if (!inputReplayer && getStringOption("recordinputs", tracefile)) {
+        inputRecorder = InputTraceRecorderPtr(new InputTraceRecorder);
+        err = inputRecorder->open(tracefile, zeroPosActive(), movementActive());
+        if (!Error::isOK(err)) terminateAppWith(err);
+      }
 
       // - create and start API server and wait for things to happen
       string apiport;
@@ -478,7 +462,24 @@ public:
         apiServer = SocketCommPtr(new SocketComm(MainLoop::currentMainLoop()));
         apiServer->setConnectionParams(NULL, apiport.c_str(), SOCK_STREAM, AF_INET);
         apiServer->setAllowNonlocalConnections(getOption("jsonapinonlocal"));
-        apiServer->startServer(boost::bind(&P44WiperD::apiConnectionHandler, this, _1), 3);
+        int maxConnections = DEFAULT_API_MAX_CONNECTIONS;
+        getIntOption("apimaxconnections", maxConnections);
+        apiServer->startServer(boost::bind(&P44WiperD::apiConnectionHandler, this, _1), maxConnections>0 ? maxConnections : 1);
+      }
+      // - metrics server
+      string metricsport;
+      if (getStringOption("metricsport", metricsport)) {
+        metricsServer = SocketCommPtr(new SocketComm(MainLoop::currentMainLoop()));
+        metricsServer->setConnectionParams(NULL, metricsport.c_str(), SOCK_STREAM, AF_INET);
+        metricsServer->setAllowNonlocalConnections(getOption("jsonapinonlocal"));
+        metricsServer->startServer(boost::bind(&P44WiperD::metricsConnectionHandler, this, _1), 2);
+      }
+      // - shared memory status block
+      string statusblockpath;
+      if (getStringOption("statusblock", statusblockpath)) {
+        statusBlock = StatusBlockPublisherPtr(new StatusBlockPublisher);
+        ErrorPtr err = statusBlock->open(statusblockpath);
+        if (!Error::isOK(err)) terminateAppWith(err);
       }
 
 
@@ -490,10 +491,24 @@ public:
 
   virtual void initialize()
   {
+    // start watching mainloop responsiveness
+    if (watchdog) watchdog->start(settings.watchdogLimit*Second, boost::bind(&P44WiperD::watchdogEmergencyStop, this), boost::bind(&P44WiperD::watchdogRecovered, this));
+    // start checkpointing usage counters
+    MainLoop::currentMainLoop().executeTicketOnce(usageCheckpointTicket, boost::bind(&P44WiperD::usageCheckpoint, this), USAGE_CHECKPOINT_INTERVAL);
+    // start motor simulation
+    if (simulateMotor) {
+      simLastStep = MainLoop::now();
+      simTimer();
+    }
+    // start replaying recorded inputs
+    if (inputReplayer) {
+      inputReplayer->start(boost::bind(&P44WiperD::replayInputEvent, this, _1), boost::bind(&P44WiperD::replayDone, this));
+    }
     // execute command line actions, if any
     if (!execCommandLineActions()) {
-      // get initial mode
-      runMode = (RunMode)settings.initialMode;
+      // get initial mode, from schedule if there is one
+      int scheduledMode = schedule.start(boost::bind(&P44WiperD::scheduledModeChanged, this, _1));
+      runMode = scheduledMode>=0 ? (RunMode)scheduledMode : (RunMode)settings.initialMode;
       // normal operation
       normalOperation();
     }
@@ -503,6 +518,29 @@ public:
 
   virtual void cleanup(int aExitCode)
   {
+    if (watchdog) watchdog->stop();
+    if (motorDriver) {
+      // stop motor and remember where we are for a quick start next time
+      bool wasDriving = motorDriver->getCurrentPower()>0;
+      motorDriver->stop();
+      if (wasDriving) {
+        // arm keeps coasting or falls back after power is cut, it may well end up on the other side of zero
+        LOG(LOG_NOTICE, "Motor was powered at shutdown, position will not be trusted at next startup");
+        runState.lastMvState = mv_unknown;
+        runState.lastAngle = 0;
+        runState.lastAngleConfidence = 0;
+      }
+      else {
+        runState.lastMvState = positionKnown() ? mvState : mv_unknown;
+        runState.lastAngle = positionEstimator->currentAngle();
+        runState.lastAngleConfidence = positionEstimator->confidence();
+      }
+      runState.cleanShutdown = true;
+      updateLifetimeUsage();
+      runState.save();
+      LOG(LOG_INFO, "Saved state for next startup, mvState=%d", runState.lastMvState);
+    }
+    if (statusBlock) statusBlock->close();
   }
 
 
@@ -511,6 +549,12 @@ public:
   bool execCommandLineActions()
   {
     string s;
+    if (getStringOption("characterize",s)) {
+      // on hardware only, simulated characterization is already done in main()
+      ErrorPtr err = characterize(s);
+      if (!Error::isOK(err)) terminateAppWith(err);
+      return true;
+    }
     if (getStringOption("calibrate",s)) {
       calibrate(boost::bind(&P44WiperD::terminateAppWith, this, _1));
       return true;
@@ -546,17 +590,61 @@ public:
   }
 
 
+  ErrorPtr characterize(const string &aCSVPath)
+  {
+    std::vector<double> powers, ramps, exps;
+    ErrorPtr err = RampCharacterizer::parseList(getOption("charpowers", "40,60,80,100"), powers);
+    if (Error::isOK(err)) err = RampCharacterizer::parseList(getOption("charramps", "0,0.5,1"), ramps);
+    if (Error::isOK(err)) err = RampCharacterizer::parseList(getOption("charexps", "0"), exps);
+    if (!Error::isOK(err)) return err;
+    double hold = 3;
+    double sample = 1;
+    string s;
+    if (getStringOption("charhold", s)) sscanf(s.c_str(), "%lf", &hold);
+    if (getStringOption("charsample", s)) sscanf(s.c_str(), "%lf", &sample);
+    characterizer = RampCharacterizerPtr(new RampCharacterizer);
+    characterizer->setGrid(powers, ramps, exps, hold);
+    err = characterizer->openCSV(aCSVPath);
+    if (!Error::isOK(err)) return err;
+    if (getOption("simulate")) {
+      // Note: synchronous, only to be called before mainloop runs
+      int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+      getIntOption("charthreads", threads);
+      MotorSimulator::Params sp = MotorSimulator::defaultParams(settings.calibrateRotationTime, settings.calibratePower);
+      return characterizer->runSimulated(sp, sample/1000, threads);
+    }
+    characterizer->runOnHardware(motorDriver, zeroPosInput, sample*MilliSecond, boost::bind(&P44WiperD::terminateAppWith, this, _1));
+    return ErrorPtr();
+  }
+
+
   void setMode(RunMode aRunMode)
   {
     if (aRunMode!=runMode) {
+      if (runMode==run_position) endPositioning();
       runUntil = Never;
       runMode = aRunMode;
+      publishStatus();
     }
     checkSwing();
   }
 
 
 
+  RunMode defaultMode()
+  {
+    int m = schedule.modeAt(time(NULL));
+    return m>=0 ? (RunMode)m : (RunMode)settings.initialMode;
+  }
+
+
+  void scheduledModeChanged(int aMode)
+  {
+    LOG(LOG_NOTICE, "Scheduled mode change to %d", aMode);
+    setMode((RunMode)aMode);
+  }
+
+
   void normalOperation()
   {
     LOG(LOG_NOTICE, "Starting normal operation");
@@ -602,6 +690,7 @@ public:
 
   void buttonHandler(bool aState, bool aHasChanged, MLMicroSeconds aTimeSincePreviousChange)
   {
+    if (inputRecorder) inputRecorder->record(trace_button, aState, aHasChanged, (long)(aTimeSincePreviousChange/MilliSecond));
     if (aHasChanged && !aState && aTimeSincePreviousChange>5*Second) {
       // pressed more than 5 seconds
       stopSwing();
@@ -610,7 +699,7 @@ public:
     else if (aHasChanged && !aState) {
       if (runMode==run_off) {
         // restart
-        setMode((RunMode)settings.initialMode); // initial mode again
+        setMode(defaultMode()); // initial (or currently scheduled) mode again
         normalOperation();
       }
       else {
@@ -624,22 +713,69 @@ public:
 
   void movementHandler(bool aNewState)
   {
+    if (inputRecorder) inputRecorder->record(trace_movement, aNewState);
     LOG(LOG_NOTICE, "Movement signal = %d", aNewState);
     redLed->steady(aNewState);
     if (aNewState) {
       // trigger
+      movementTriggers++;
       checkMovement();
     }
   }
 
 
 
+  // MARK: ===== input trace replay
+
+
+  /// @return current zero position input state (replayed state when replaying a trace)
+  bool zeroPosActive()
+  {
+    if (inputReplayer) return replayedZeroPos;
+    if (simulateMotor) return simulatedZeroPos;
+    return zeroPosInput->isSet();
+  }
+
+
+  /// @return current movement input state (replayed state when replaying a trace)
+  bool movementActive()
+  {
+    return inputReplayer ? replayedMovement : movementInput->isSet();
+  }
+
+
+  void replayInputEvent(const InputTraceEvent &aEvent)
+  {
+    switch (aEvent.source) {
+      case trace_zeropos:
+        replayedZeroPos = aEvent.value!=0;
+        zeroPosHandler(replayedZeroPos);
+        break;
+      case trace_movement:
+        replayedMovement = aEvent.value!=0;
+        movementHandler(replayedMovement);
+        break;
+      case trace_button:
+        buttonHandler(aEvent.value!=0, aEvent.extra!=0, aEvent.extra2*MilliSecond);
+        break;
+    }
+  }
+
+
+  void replayDone()
+  {
+    if (getOption("replayexit")) terminateApp(EXIT_SUCCESS);
+  }
+
+
+
   // MARK: ===== movement sequences
 
 
   void stopOps()
   {
-    MainLoop::currentMainLoop().cancelExecutionTicket(opTicket);
+    deadlines.cancel(dl_operation);
+    positionEstimator->cancelWatch();
   }
 
 
@@ -660,41 +796,82 @@ public:
 
 
 
+  void motorOutputChanged(double aPower, int aDirection)
+  {
+    if (simulateMotor) {
+      // previous output applied until now
+      simAdvance();
+      simPower = aPower;
+      simDirection = aDirection;
+    }
+    positionEstimator->motorChanged(aPower, aDirection);
+    if (motorLog) motorLog->log(aPower, aDirection);
+    if (aDirection!=0 && motorDriver->isWaveformRunning() && aDirection!=currentDir()) {
+      // waveform reversed direction: now heading towards midpoint again
+      if (swingTuner.isActive()) {
+        if (swingTuner.reversal(positionEstimator->currentAngle(), positionEstimator->confidence()>=MIN_POSITION_CONFIDENCE)) {
+          autotuneEnd();
+          return;
+        }
+        // next trial's parameters
+        motorDriver->setWaveformParams(2*settings.swingPeriod, settings.swingMinPower, settings.swingMaxPower, settings.dirChangeTime);
+        swingTuner.accelerating();
+      }
+      setMvState(aDirection>0 ? mv_swing_cw_before_zero : mv_swing_ccw_before_zero);
+      if (aDirection>0) sessionSwingCycles++;
+    }
+    publishStatus();
+  }
+
+
   void zeroPosHandler(bool aNewState)
   {
+    if (inputRecorder) inputRecorder->record(trace_zeropos, aNewState);
     LOG(LOG_INFO, "Zero position signal = %d", aNewState);
     greenLed->steady(aNewState);
     if (settings.wiperType==wiper_software) {
       if (aNewState) {
         // starting edge
+        positionEstimator->anchorAtZero();
         switch (mvState) {
           // calibration states
           case mv_calibrate_find_zero:
             // first zero pos pass, now start measuring
-            mvState = mv_calibrate_measure;
+            setMvState(mv_calibrate_measure);
             break;
           case mv_calibrate_measure:
             // second zero pos pass, done
-            mvState = mv_zeroed;
+            setMvState(mv_zeroed);
             settings.calibrateRotationTime = (double)(MainLoop::now()-lastZeroPosTime)/Second;
+            sessionCalibrations++;
+            positionEstimator->setCalibration(settings.calibrateRotationTime, settings.calibratePower);
             motorDriver->stop();
             LOG(LOG_NOTICE, "Calibration done, rotation time = %.2f Seconds", settings.calibrateRotationTime);
-            saveChanges();
+            settings.saveChanges();
             endOp();
             break;
           // zero find states
           case mv_return_zero_cw:
           case mv_return_zero_ccw:
-            mvState = mv_zeroed;
-            motorDriver->stop();
+          case mv_return_zero_more_cw:
+          case mv_return_zero_more_ccw:
             LOG(LOG_NOTICE, "Found zero position");
-            endOp();
+            zeroFindEnd(true);
             break;
           // swing states ;-)
           case mv_swing_cw_before_zero:
           case mv_swing_ccw_before_zero:
+            if (!swinging) {
+              // passing zero while halting: just keep track of the side we are on now
+              setMvState(mvState==mv_swing_cw_before_zero ? mv_swing_cw_after_zero : mv_swing_ccw_after_zero);
+              break;
+            }
             LOG(LOG_INFO,"Swing midpoint DETECTED");
-            swingMidpoint();
+            if (motorDriver->isWaveformRunning()) {
+              waveformMidpoint();
+              break;
+            }
+            swingMidpoint(true);
             break;
           default:
             break;
@@ -716,7 +893,7 @@ public:
     else {
       // smoothly start turning
       motorDriver->stop();
-      mvState = mv_busy;
+      setMvState(mv_busy);
       motorDriver->rampToPower(settings.calibratePower, 1, 1, 0, boost::bind(&P44WiperD::calibrateUpToSpeed, this));
     }
   }
@@ -728,8 +905,8 @@ public:
   {
     // start actual calibration process now
     LOG(LOG_NOTICE, "Starting calibration round");
-    mvState = mv_calibrate_find_zero;
-    MainLoop::currentMainLoop().executeTicketOnce(opTicket, boost::bind(&P44WiperD::calibrateTimeout, this), MAX_CALIBRATE_TIME);
+    setMvState(mv_calibrate_find_zero);
+    deadlines.setIn(dl_operation, MAX_CALIBRATE_TIME, boost::bind(&P44WiperD::calibrateTimeout, this));
   }
 
 
@@ -744,19 +921,118 @@ public:
   void findZero(StatusCB aDoneCB)
   {
     startOp(aDoneCB);
+    zeroFindStart = MainLoop::now();
     motorDriver->stop();
     if (settings.wiperType==wiper_mechanical) {
       endOp(); // NOP
     }
     else {
-      if (zeroPosInput->isSet()) {
+      int dir = expectedZeroDirection();
+      if (zeroPosActive()) {
         zeroFindEnd(true);
         return;
       }
-      // - move at max one quarter clockwise
-      mvState = mv_return_zero_cw;
-      motorDriver->rampToPower(settings.calibratePower, 1, settings.findZeroRamp);
-      MainLoop::currentMainLoop().executeTicketOnce(opTicket, boost::bind(&P44WiperD::zeroFindTimeout, this), settings.calibrateRotationTime*settings.rezeroSwingAngle/360*Second);
+      // - move at max rezeroSwingAngle (or a bit beyond where the estimate expects zero) towards the side where zero is expected
+      zeroSearchFirstLeg = settings.rezeroSwingAngle;
+      if (positionEstimator->confidence()>=MIN_POSITION_CONFIDENCE) {
+        double expected = positionEstimator->travelTo(0, dir)+ZERO_SEARCH_MARGIN;
+        if (expected<zeroSearchFirstLeg) zeroSearchFirstLeg = expected;
+      }
+      setMvState(dir>0 ? mv_return_zero_cw : mv_return_zero_ccw);
+      motorDriver->rampToPower(settings.calibratePower, dir, settings.findZeroRamp);
+      positionEstimator->watchTravel(zeroSearchFirstLeg, boost::bind(&P44WiperD::zeroFindTimeout, this));
+    }
+  }
+
+
+  /// @return direction in which to search zero first. Uses the position estimate if confident enough,
+  ///   otherwise the state from a clean shutdown (once), clockwise otherwise
+  int expectedZeroDirection()
+  {
+    int dir = 1; // default: clockwise first
+    if (positionEstimator->confidence()>=MIN_POSITION_CONFIDENCE) {
+      trustedMvState = mv_unknown; // estimate is better
+      double a = positionEstimator->currentAngle();
+      LOG(LOG_NOTICE, "Position estimate %.1f degrees (confidence %.2f): searching zero %s first", a, positionEstimator->confidence(), a>0 ? "counterclockwise" : "clockwise");
+      return a>0 ? -1 : 1;
+    }
+    switch (trustedMvState) {
+      case mv_swing_cw_after_zero: // passed zero clockwise
+      case mv_swing_ccw_before_zero: // was returning counterclockwise towards zero
+        dir = -1;
+        break;
+      case mv_zeroed:
+        if (!zeroPosActive()) {
+          LOG(LOG_WARNING, "Was at zero position at shutdown, but zero input is not set -> full search");
+        }
+        break;
+      default:
+        break;
+    }
+    if (trustedMvState!=mv_unknown) {
+      LOG(LOG_NOTICE, "Using state from clean shutdown: searching zero %s first", dir>0 ? "clockwise" : "counterclockwise");
+    }
+    trustedMvState = mv_unknown; // use only once
+    return dir;
+  }
+
+
+  void setMvState(MvState aMvState)
+  {
+    MLMicroSeconds now = MainLoop::now();
+    timeInState[mvState] += now-mvStateSince;
+    mvStateSince = now;
+    mvState = aMvState;
+    publishStatus();
+  }
+
+
+  /// update the shared memory status block, if any. Cheap enough to be called on every change.
+  void publishStatus()
+  {
+    if (!statusBlock) return;
+    WiperStatusData d;
+    memset(&d, 0, sizeof(d));
+    d.runUntil = runUntil==Never ? 0 : runUntil-MainLoop::now()+MainLoop::unixtime();
+    d.power = motorDriver->getCurrentPower();
+    d.direction = motorDriver->getCurrentDirection();
+    d.mvState = mvState;
+    d.runMode = runMode;
+    d.swinging = swinging;
+    d.swingCycles = sessionSwingCycles;
+    d.motorReversals = motorDriver->getUsage().reversals;
+    d.movementTriggers = movementTriggers;
+    d.calibrations = sessionCalibrations;
+    d.zeroFindFailures = zeroFindFailures;
+    statusBlock->publish(d);
+  }
+
+
+  static const char *mvStateName(int aMvState)
+  {
+    static const char *names[mv_numStates] = {
+      "unknown", "busy", "calibrate_find_zero", "calibrate_measure",
+      "return_zero_cw", "return_zero_ccw", "return_zero_more_ccw", "return_zero_more_cw",
+      "zeroed", "swing_cw_before_zero", "swing_cw_after_zero", "swing_ccw_before_zero", "swing_ccw_after_zero",
+      "pattern", "position"
+    };
+    return aMvState>=0 && aMvState<mv_numStates ? names[aMvState] : "?";
+  }
+
+
+  /// @return true if mvState reliably tells where the arm is relative to the zero position
+  bool positionKnown()
+  {
+    switch (mvState) {
+      case mv_zeroed:
+      case mv_swing_cw_before_zero:
+      case mv_swing_cw_after_zero:
+      case mv_swing_ccw_before_zero:
+      case mv_swing_ccw_after_zero:
+      case mv_position:
+        return true;
+      default:
+        return false;
     }
   }
 
@@ -764,13 +1040,15 @@ public:
   void zeroFindTimeout()
   {
     LOG(LOG_DEBUG, "zeroFindTimeout");
-    if (mvState==mv_return_zero_cw) {
+    if (mvState==mv_return_zero_cw || mvState==mv_return_zero_ccw) {
       // try other direction
-      mvState = mv_return_zero_ccw;
-      motorDriver->rampToPower(settings.calibratePower, -1, settings.findZeroRamp);
-      MainLoop::currentMainLoop().executeOnce(boost::bind(&P44WiperD::zeroFindTimeout, this), settings.calibrateRotationTime*settings.rezeroSwingAngle/360*2*Second);
+      int dir = mvState==mv_return_zero_cw ? -1 : 1;
+      setMvState(dir>0 ? mv_return_zero_more_cw : mv_return_zero_more_ccw);
+      motorDriver->rampToPower(settings.calibratePower, dir, settings.findZeroRamp);
+      // - back to where we started, plus rezeroSwingAngle on the other side
+      positionEstimator->watchTravel(zeroSearchFirstLeg+settings.rezeroSwingAngle, boost::bind(&P44WiperD::zeroFindTimeout, this));
     }
-    else if (mvState==mv_return_zero_ccw) {
+    else if (mvState==mv_return_zero_more_cw || mvState==mv_return_zero_more_ccw) {
       // not found in other direction
       zeroFindEnd(false);
     }
@@ -782,10 +1060,12 @@ public:
     ErrorPtr err;
     motorDriver->stop();
     if (aSuccess) {
-      mvState = mv_zeroed;
+      setMvState(mv_zeroed);
+      zeroFindTimes.add(MainLoop::now()-zeroFindStart);
     }
     else {
-      mvState = mv_unknown;
+      setMvState(mv_unknown);
+      zeroFindFailures++;
       err = TextError::err("Zero not within %d degrees range, needs calibration", (int)settings.rezeroSwingAngle);
     }
     endOp(err);
@@ -801,15 +1081,15 @@ public:
         // is on
         if (
           (runUntil==Never) || // no run time set at all
-          (now>runUntil) || // current trigger time exhausted
-          (lastSwingChange!=Never && now>lastSwingChange+settings.maxRunTime*Second) // total run time exhausted
+          (now>=runUntil) || // current trigger time exhausted
+          (lastSwingChange!=Never && now>=lastSwingChange+settings.maxRunTime*Second) // total run time exhausted
         ) {
           LOG(LOG_NOTICE, "Timed run ends here -> stopping");
           stopSwing();
         }
-        else if (runUntil!=Never) {
+        else {
           // schedule a re-check in time
-          MainLoop::currentMainLoop().executeTicketOnceAt(extraCheckSwingTicket, boost::bind(&P44WiperD::checkSwing, this), runUntil);
+          scheduleRunEndCheck();
         }
       }
       else {
@@ -822,8 +1102,14 @@ public:
           else {
             // pause not yet over
             LOG(LOG_NOTICE, "Pause not yet over -> not starting");
+            // early activity: get ready, but only for the last preArmTime of the pause
+            if (settings.preArmTime>0) {
+              MLMicroSeconds preArmAt = preArmStart();
+              if (now>=preArmAt) preArm();
+              else if (!preArmed) deadlines.setAt(dl_preArm, preArmAt, boost::bind(&P44WiperD::preArm, this));
+            }
             // schedule a re-check of movement status in time
-            MainLoop::currentMainLoop().executeTicketOnceAt(extraCheckSwingTicket, boost::bind(&P44WiperD::checkMovement, this), startNotBefore);
+            deadlines.setAt(dl_pauseEnd, startNotBefore, boost::bind(&P44WiperD::checkMovement, this));
           }
         }
       }
@@ -832,6 +1118,9 @@ public:
       // unconditionally start
       startSwing();
     }
+    else if (runMode==run_position) {
+      // position control holds the arm, nothing to do
+    }
     else {
       // otherwise: stop
       stopSwing();
@@ -839,10 +1128,20 @@ public:
   }
 
 
+  /// schedule re-checks of the swing at trigger expiry and total run time expiry
+  void scheduleRunEndCheck()
+  {
+    if (runUntil!=Never) deadlines.setAt(dl_triggerExpiry, runUntil, boost::bind(&P44WiperD::checkSwing, this));
+    else deadlines.cancel(dl_triggerExpiry);
+    deadlines.setAt(dl_maxRun, lastSwingChange+settings.maxRunTime*Second, boost::bind(&P44WiperD::checkSwing, this));
+  }
+
+
   void checkMovement()
   {
-    if (movementInput->isSet()) {
+    if (movementActive()) {
       runUntil = MainLoop::now()+settings.runTimeAfterMovement*Second;
+      publishStatus();
       checkSwing();
     }
   }
@@ -853,25 +1152,42 @@ public:
   void startSwing()
   {
     if (!swinging) {
+      if (preArmed) {
+        // swing starts from the idle power already applied
+        deadlines.cancel(dl_preArm);
+        preArmed = false;
+      }
       if (settings.wiperType==wiper_mechanical) {
-        // simple mechanical wiper
+        // simple mechanical wiper: just run, settingsChanged() and run end check take care of the rest
+        swinging = true;
+        motorDriver->rampToPower(settings.swingMaxPower, 1, -settings.haltTime, 0);
+      }
+      else if (patterns.selectedPattern() && (positionKnown() || mvState==mv_pattern)) {
+        // software wiper running a motion pattern
         swinging = true;
-        MainLoop::currentMainLoop().executeTicketOnce(mechModeCheckTicket, boost::bind(&P44WiperD::mechanicalSwingRecheck, this), 0.3*Second);
+        setMvState(mv_pattern);
+        runPattern();
       }
       else {
         // software wiper
         switch (mvState) {
           case mv_zeroed:
-            mvState = mv_swing_cw_before_zero; // start clockwise
+          case mv_position:
+            setMvState(mv_swing_cw_before_zero); // start clockwise
             goto run;
           case mv_swing_cw_before_zero:
           case mv_swing_ccw_before_zero:
           case mv_swing_cw_after_zero:
           case mv_swing_ccw_after_zero:
           run:
-            if (zeroPosInput->isSet()) {
+            if (waveformSwing()) {
+              // periodic waveform, synced at detected midpoints
+              startWaveformSwing();
+              if (zeroPosActive()) motorDriver->syncWaveformToPeak(currentDir());
+            }
+            else if (zeroPosActive()) {
               // special case: start swing from "hanging" down position
-              swingMidpoint();
+              swingMidpoint(true);
             }
             else {
               // accelerate towards midpoint
@@ -887,31 +1203,160 @@ public:
         swinging = true;
       }
       lastSwingChange = MainLoop::now();
+      if (runMode==run_auto) scheduleRunEndCheck();
+      publishStatus();
     }
   }
 
 
+  /// @return true if swing runs as a periodic waveform rather than chained ramps
+  bool waveformSwing()
+  {
+    return settings.swingCurveType>=2;
+  }
+
+
+  ErrorPtr loadWaveform(const string &aFilePath)
+  {
+    FILE *f = fopen(aFilePath.c_str(), "r");
+    if (!f) return SysError::errNo("cannot open waveform file: ");
+    string text;
+    string_fgetfile(f, text);
+    fclose(f);
+    JsonObjectPtr w = JsonObject::objFromText(text.c_str());
+    if (!w || !w->isType(json_type_array) || w->arrayLength()<2) {
+      return TextError::err("waveform file '%s' must contain a JSON array with at least 2 values", aFilePath.c_str());
+    }
+    userWaveform.clear();
+    userWaveform.reserve(w->arrayLength());
+    for (int i=0; i<w->arrayLength(); i++) {
+      double v = w->arrayGet(i)->doubleValue();
+      if (v>1) v = 1;
+      else if (v<-1) v = -1;
+      userWaveform.push_back(v);
+    }
+    LOG(LOG_NOTICE, "Loaded user swing waveform with %d points", (int)userWaveform.size());
+    return ErrorPtr();
+  }
+
+
+  void startWaveformSwing()
+  {
+    // starts towards the middle like swingAccelerate(), so currentDir() (also used for syncing afterwards) matches nextSwingDir()
+    convertToAcceleratingState();
+    const std::vector<double> &w = settings.swingCurveType==3 && !userWaveform.empty() ? userWaveform : sineWaveform;
+    // one swing (half period) takes swingPeriod
+    motorDriver->runWaveform(w, 2*settings.swingPeriod, settings.swingMinPower, settings.swingMaxPower, settings.dirChangeTime, currentDir()<0 ? 0.5 : 0);
+  }
+
+
   void stopSwing()
   {
+    endPreArm();
     if (swinging) {
       // swinging active
-      MainLoop::currentMainLoop().cancelExecutionTicket(mechModeCheckTicket);
-      MainLoop::currentMainLoop().cancelExecutionTicket(midPointSimTicket);
+      deadlines.cancel(dl_triggerExpiry);
+      deadlines.cancel(dl_maxRun);
+      deadlines.cancel(dl_midpointFallback);
+      positionEstimator->cancelWatch();
       motorDriver->rampToPower(0, 0, -settings.haltTime, 0);
+      if (mvState==mv_pattern) patternEnded();
+      swingTuner.abort(); // NOP if not tuning
       swinging = false;
       lastSwingChange = MainLoop::now();
+      if (runMode==run_auto && settings.preArmTime>0) {
+        // get ready shortly before the pause ends
+        deadlines.setAt(dl_preArm, preArmStart(), boost::bind(&P44WiperD::preArm, this));
+      }
+      publishStatus();
     }
   }
 
 
-  void mechanicalSwingRecheck()
+  /// @return direction the next swing will start in, 0 if not known
+  int nextSwingDir()
+  {
+    switch (mvState) {
+      case mv_zeroed:
+      case mv_position:
+      case mv_swing_cw_before_zero:
+      case mv_swing_ccw_after_zero:
+        return 1;
+      case mv_swing_ccw_before_zero:
+      case mv_swing_cw_after_zero:
+        return -1;
+      default:
+        return 0;
+    }
+  }
+
+
+  /// @return when pre-arming may start: preArmTime before the end of the pause, but not before the halt after the last swing is complete
+  MLMicroSeconds preArmStart()
   {
-    checkSwing();
+    MLMicroSeconds at = lastSwingChange+(settings.pauseTime-settings.preArmTime)*Second;
+    MLMicroSeconds haltEnd = lastSwingChange+settings.haltTime*Second;
+    return at<haltEnd ? haltEnd : at;
+  }
+
+
+  /// hold idle power towards the next swing, so a trigger starts the swing from there instead of from rest
+  /// @note idle power is held until preArmTime after the end of the pause at most, because the arm creeps and
+  ///   the swing direction is not re-evaluated meanwhile
+  void preArm()
+  {
+    if (swinging || preArmed || runMode!=run_auto) return;
+    int dir = settings.wiperType==wiper_mechanical ? 1 : nextSwingDir();
+    if (dir==0) return; // position unknown, cannot prepare
+    LOG(LOG_INFO, "Pre-arming: holding %.0f%% idle power, direction %d", settings.preArmPower, dir);
+    preArmed = true;
+    motorDriver->rampToPower(settings.preArmPower, dir, -settings.haltTime, 0);
+    // give up when no trigger arrives in time
+    deadlines.setAt(dl_preArm, lastSwingChange+(settings.pauseTime+settings.preArmTime)*Second, boost::bind(&P44WiperD::endPreArm, this));
+  }
+
+
+  void endPreArm()
+  {
+    deadlines.cancel(dl_preArm);
+    if (preArmed) {
+      LOG(LOG_INFO, "Pre-arm ends, idle power off");
+      preArmed = false;
+      if (!swinging) motorDriver->rampToPower(0, 0, -settings.haltTime, 0);
+    }
+  }
+
+
+  /// settings file was (re)written: apply it, and changed settings to running operations
+  void settingsFileChanged()
+  {
+    int changed;
+    ErrorPtr err = settings.applyFile(settingsFilePath, changed);
+    if (!Error::isOK(err)) {
+      LOG(LOG_ERR, "Settings file not applied, keeping current settings: %s", err->description().c_str());
+      return;
+    }
+    LOG(LOG_NOTICE, "Settings file reloaded, %d setting(s) changed", changed);
+    if (changed>0) settingsChanged();
+  }
+
+
+  /// apply changed settings to running operations
+  void settingsChanged()
+  {
+    positionEstimator->setCalibration(settings.calibrateRotationTime, settings.calibratePower);
+    motorDriver->setReversalBrake(settings.reversalBrakePower, settings.reversalBrakeTime);
+    watchdog->setHardLimit(settings.watchdogLimit*Second);
     if (swinging) {
-      // ramp to new power (usually already set, but in case settings are changed we want see it change speed live)
-      motorDriver->rampToPower(settings.swingMaxPower, 1, -settings.haltTime, 0);
-      // must check for timeouts in regular intervals
-      MainLoop::currentMainLoop().executeTicketOnce(mechModeCheckTicket, boost::bind(&P44WiperD::mechanicalSwingRecheck, this), 0.3*Second);
+      if (settings.wiperType==wiper_mechanical) {
+        // see speed change live
+        motorDriver->rampToPower(settings.swingMaxPower, 1, -settings.haltTime, 0);
+      }
+      else if (motorDriver->isWaveformRunning()) {
+        motorDriver->setWaveformParams(2*settings.swingPeriod, settings.swingMinPower, settings.swingMaxPower, settings.dirChangeTime);
+      }
+      // run time limits might have changed
+      checkSwing();
     }
   }
 
@@ -929,36 +1374,70 @@ public:
   }
 
 
+  DcMotorDriver::RampProfile swingProfile()
+  {
+    return settings.swingCurveType==1 ? DcMotorDriver::ramp_scurve : DcMotorDriver::ramp_exp;
+  }
+
+
+  /// swings always start towards the middle: convert after-zero states to the before-zero state of the opposite direction
+  void convertToAcceleratingState()
+  {
+    if (mvState==mv_swing_cw_after_zero) setMvState(mv_swing_ccw_before_zero);
+    else if (mvState==mv_swing_ccw_after_zero) setMvState(mv_swing_cw_before_zero);
+  }
+
+
   void swingAccelerate()
   {
     // always towards middle, so always before zero
     // - convert to accelrating state
-    if (mvState==mv_swing_cw_after_zero) mvState = mv_swing_ccw_before_zero;
-    else if (mvState==mv_swing_ccw_after_zero) mvState = mv_swing_cw_before_zero;
+    convertToAcceleratingState();
     int dir = currentDir();
+    if (swingTuner.isActive()) swingTuner.accelerating();
     // - ramp power up twoards midpoint
-    motorDriver->rampToPower(settings.swingMaxPower, dir, settings.swingPeriod/2, settings.swingCurveExp, boost::bind(&P44WiperD::swingAccelerated, this));
+    motorDriver->rampToPower(settings.swingMaxPower, dir, settings.swingPeriod/2, settings.swingCurveExp, boost::bind(&P44WiperD::swingAccelerated, this), swingProfile());
   }
 
 
   void swingAccelerated()
   {
-    LOG(LOG_INFO,"Swing accelerated to max, waiting for midpoint, current dir = %d", currentDir());
+    int dir = currentDir();
+    LOG(LOG_INFO,"Swing accelerated to max, waiting for midpoint, current dir = %d", dir);
     if (settings.midPointSearchTime) {
-      MainLoop::currentMainLoop().executeTicketOnce(midPointSimTicket, boost::bind(&P44WiperD::swingMidpoint, this), settings.midPointSearchTime*Second);
+      deadlines.setIn(dl_midpointFallback, settings.midPointSearchTime*Second, boost::bind(&P44WiperD::swingMidpoint, this, false));
+    }
+    if (positionEstimator->confidence()>=MIN_POSITION_CONFIDENCE) {
+      // also simulate midpoint when estimate says we are past it
+      double toMid = positionEstimator->travelTo(0, dir);
+      if (toMid>180) toMid = 0; // already past
+      positionEstimator->watchTravel(toMid+MIDPOINT_MARGIN, boost::bind(&P44WiperD::swingMidpoint, this, false));
     }
   }
 
 
-  void swingMidpoint()
+  void swingMidpoint(bool aDetected)
   {
-    MainLoop::currentMainLoop().cancelExecutionTicket(midPointSimTicket);
+    deadlines.cancel(dl_midpointFallback);
+    positionEstimator->cancelWatch();
     int dir = currentDir();
     LOG(LOG_INFO,"Swing midpoint (detected or simulated), current dir = %d", dir);
-    mvState = dir>0 ? mv_swing_cw_after_zero : mv_swing_ccw_after_zero;
+    if (swingTuner.isActive()) swingTuner.midpoint(dir, aDetected);
+    setMvState(dir>0 ? mv_swing_cw_after_zero : mv_swing_ccw_after_zero);
     // if still on -> quickly set midpoint speed
-    motorDriver->rampToPower(settings.swingMaxPower, dir, settings.midPointAdjustTime, 0, boost::bind(&P44WiperD::swingDecelerate, this));
-    MainLoop::currentMainLoop().executeOnce(boost::bind(&P44WiperD::checkSwing, this), MilliSecond);
+    motorDriver->rampToPower(settings.swingMaxPower, dir, settings.midPointAdjustTime, 0, boost::bind(&P44WiperD::swingDecelerate, this), swingProfile());
+    // re-check run time limits right after this handler (checkSwing() re-arms the trigger expiry anyway)
+    deadlines.setIn(dl_triggerExpiry, 0, boost::bind(&P44WiperD::checkSwing, this));
+  }
+
+
+  void waveformMidpoint()
+  {
+    int dir = currentDir();
+    if (swingTuner.isActive()) swingTuner.midpoint(dir, true);
+    setMvState(dir>0 ? mv_swing_cw_after_zero : mv_swing_ccw_after_zero);
+    motorDriver->syncWaveformToPeak(dir);
+    checkSwing();
   }
 
 
@@ -967,7 +1446,7 @@ public:
     // assuming midpoint at full speed
     int dir = currentDir();
     // - ramp power down twoards endpoint
-    motorDriver->rampToPower(settings.swingMinPower, dir, settings.swingPeriod/2, -settings.swingCurveExp, boost::bind(&P44WiperD::swingDecelerated, this));
+    motorDriver->rampToPower(settings.swingMinPower, dir, settings.swingPeriod/2, -settings.swingCurveExp, boost::bind(&P44WiperD::swingDecelerated, this), swingProfile());
   }
 
 
@@ -976,10 +1455,18 @@ public:
     // change direction
     int dir = currentDir();
     LOG(LOG_INFO,"Swing decelerated to minimum, current dir = %d -> reversing direction", dir);
-    mvState = dir>0 ? mv_swing_ccw_before_zero : mv_swing_cw_before_zero;
+    if (swingTuner.isActive()) {
+      if (swingTuner.reversal(positionEstimator->currentAngle(), positionEstimator->confidence()>=MIN_POSITION_CONFIDENCE)) {
+        autotuneEnd();
+        return;
+      }
+    }
+    setMvState(dir>0 ? mv_swing_ccw_before_zero : mv_swing_cw_before_zero);
     dir = currentDir();
+    if (dir>0) sessionSwingCycles++; // back to clockwise: one full cycle
+    publishStatus();
     // - same power, but reversed direction
-    motorDriver->rampToPower(settings.swingMinPower, dir, settings.dirChangeTime, 0, boost::bind(&P44WiperD::swingDirChanged, this));
+    motorDriver->rampToPower(settings.swingMinPower, dir, settings.dirChangeTime, 0, boost::bind(&P44WiperD::swingDirChanged, this), swingProfile());
   }
 
 
@@ -990,8 +1477,416 @@ public:
     swingAccelerate();
   }
 
+
+
+  // MARK: ===== swing autotune
+
+
+  ErrorPtr startAutotune(JsonObjectPtr aParams)
+  {
+    if (settings.wiperType!=wiper_software) return WebError::webErr(409, "autotune needs software wiper type");
+    if (patterns.selectedPattern()) return WebError::webErr(409, "autotune does not work with a motion pattern selected");
+    if (swingTuner.isActive()) return WebError::webErr(409, "autotune already running");
+    if (!positionKnown()) return WebError::webErr(409, "position unknown, find zero first");
+    JsonObjectPtr o;
+    double amplitude = 0;
+    double period = 0;
+    int cycles = 3;
+    int trials = 20;
+    if (aParams->get("amplitude", o)) amplitude = o->doubleValue();
+    if (aParams->get("period", o)) period = o->doubleValue();
+    if (aParams->get("cycles", o)) cycles = o->int32Value();
+    if (aParams->get("trials", o)) trials = o->int32Value();
+    ErrorPtr err = swingTuner.start(amplitude, period, cycles, trials);
+    if (Error::isOK(err)) {
+      // swing continuously while tuning
+      autotuneRestoreMode = runMode;
+      setMode(run_always);
+    }
+    return err;
+  }
+
+
+  void autotuneEnd()
+  {
+    // tuner has set the best parameters found, make them permanent
+    settings.saveChanges();
+    stopSwing();
+    setMode(autotuneRestoreMode);
+  }
+
+
+
+  // MARK: ===== motion patterns
+
+
+  void runPattern()
+  {
+    MotionPatternPtr pattern = patterns.selectedPattern();
+    if (!pattern) {
+      // deselected in the meantime
+      stopSwing();
+      return;
+    }
+    LOG(LOG_INFO,"Running motion pattern '%s'", pattern->name.c_str());
+    motorDriver->runSequence(pattern->steps, boost::bind(&P44WiperD::patternDone, this, pattern->loop, _3));
+  }
+
+
+  void patternDone(bool aLoop, ErrorPtr aError)
+  {
+    if (!swinging || mvState!=mv_pattern) return; // stopped in the meantime
+    if (Error::isOK(aError) && aLoop) {
+      // repeat (with the pattern selected now)
+      runPattern();
+      return;
+    }
+    // single shot pattern, or error: done
+    stopSwing();
+  }
+
+
+  void patternEnded()
+  {
+    // return to a swing state the built-in swing can continue from, if the estimate allows
+    if (positionEstimator->confidence()>=MIN_POSITION_CONFIDENCE) {
+      setMvState(positionEstimator->currentAngle()<0 ? mv_swing_cw_before_zero : mv_swing_ccw_before_zero);
+    }
+    else {
+      setMvState(mv_unknown);
+    }
+  }
+
   
 
+  // MARK: ===== metrics
+
+
+  SocketCommPtr metricsConnectionHandler(SocketCommPtr aServerSocketComm)
+  {
+    SocketCommPtr conn = SocketCommPtr(new SocketComm(MainLoop::currentMainLoop()));
+    conn->setReceiveHandler(boost::bind(&P44WiperD::metricsRequestHandler, this, conn, _1));
+    conn->setClearHandlersAtClose(); // close must break retain cycles so this object won't cause a mem leak
+    return conn;
+  }
+
+
+  void metricsRequestHandler(SocketCommPtr aConnection, ErrorPtr aError)
+  {
+    if (!Error::isOK(aError)) return;
+    // any request gets the metrics, no need to parse it
+    string request;
+    aConnection->receiveAndAppendToString(request);
+    string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n";
+    response += metricsText();
+    aConnection->transmitString(response);
+    aConnection->closeAfterSend();
+  }
+
+
+  string metricsText()
+  {
+    string m;
+    m.reserve(6000);
+    MetricsText mt(m);
+    MLMicroSeconds now = MainLoop::now();
+    // motor
+    mt.gauge("p44wiper_motor_power_percent", "current motor power", motorDriver->getCurrentPower());
+    mt.gauge("p44wiper_motor_direction", "current motor direction (1=CW, -1=CCW, 0=off)", motorDriver->getCurrentDirection());
+    mt.summary("p44wiper_ramp_step_latency_seconds", "lateness of timer scheduled ramp steps (count = number of steps)", motorDriver->getRampStepLatency());
+    const DcMotorDriver::OutputWrites &ow = motorDriver->getOutputWrites();
+    mt.header("p44wiper_output_writes_total", "counter", "motor output writes");
+    mt.sample("p44wiper_output_writes_total", ow.issued, "result=\"issued\"");
+    mt.sample("p44wiper_output_writes_total", ow.suppressed, "result=\"suppressed\"");
+    // movement state
+    mt.gauge("p44wiper_mv_state", "current movement state", mvState);
+    mt.header("p44wiper_mv_state_seconds_total", "counter", "time spent in each movement state");
+    for (int i=0; i<mv_numStates; i++) {
+      MLMicroSeconds t = timeInState[i];
+      if (i==mvState) t += now-mvStateSince;
+      mt.sample("p44wiper_mv_state_seconds_total", (double)t/Second, string_format("state=\"%s\"", mvStateName(i)).c_str());
+    }
+    mt.gauge("p44wiper_swinging", "1 if wiper is swinging", swinging);
+    mt.counter("p44wiper_swing_cycles_total", "swing cycles since start", sessionSwingCycles);
+    mt.counter("p44wiper_movement_triggers_total", "movement sensor triggers since start", movementTriggers);
+    // zero finding and calibration
+    mt.summary("p44wiper_zero_find_duration_seconds", "duration of successful zero finds", zeroFindTimes);
+    mt.counter("p44wiper_zero_find_failures_total", "failed zero finds", zeroFindFailures);
+    mt.counter("p44wiper_calibrations_total", "calibrations since start", sessionCalibrations);
+    mt.gauge("p44wiper_calibrate_rotation_time_seconds", "calibrated rotation time", settings.calibrateRotationTime);
+    mt.gauge("p44wiper_calibrate_power_percent", "calibration power", settings.calibratePower);
+    mt.gauge("p44wiper_position_confidence", "confidence of position estimate", positionEstimator->confidence());
+    mt.gauge("p44wiper_last_anchor_error_degrees", "position estimate error found at last zero pass", positionEstimator->getLastAnchorError());
+    // API
+    mt.header("p44wiper_api_requests_total", "counter", "API requests by endpoint");
+    for (int i=0; i<numApiEndpoints; i++) {
+      mt.sample("p44wiper_api_requests_total", apiRequests[i], string_format("uri=\"%s\"", apiEndpoints[i]).c_str());
+    }
+    mt.summary("p44wiper_api_request_duration_seconds", "API request processing time", apiLatency);
+    // persistence
+    mt.summary("p44wiper_settings_save_seconds", "time spent saving settings to SQLite", settings.saveTimes);
+    mt.summary("p44wiper_runstate_save_seconds", "time spent saving run state to SQLite", runState.saveTimes);
+    return m;
+  }
+
+
+
+  // MARK: ===== watchdog
+
+
+  /// @note called from the watchdog thread while mainloop is stalled!
+  void watchdogEmergencyStop()
+  {
+    motorDriver->emergencyStop();
+  }
+
+
+  void watchdogRecovered()
+  {
+    LOG(LOG_ERR, "Mainloop was stalled, motor was stopped by watchdog -> re-zeroing");
+    stopSwing();
+    motorDriver->stop();
+    endOp(TextError::err("Mainloop stalled, motor stopped by watchdog"));
+    // position estimate is not reliable any more
+    positionEstimator->invalidate();
+    setMvState(mv_unknown);
+    normalOperation();
+  }
+
+
+
+  // MARK: ===== usage accounting
+
+
+  /// update lifetime usage counters in runState (does not save them)
+  void updateLifetimeUsage()
+  {
+    const DcMotorDriver::MotorUsage &mu = motorDriver->getUsage();
+    runState.motorOnTimeCW = motorUsageBase.onTime[0]+mu.onTime[0];
+    runState.motorOnTimeCCW = motorUsageBase.onTime[1]+mu.onTime[1];
+    runState.motorDutyTimeCW = motorUsageBase.dutyTime[0]+mu.dutyTime[0];
+    runState.motorDutyTimeCCW = motorUsageBase.dutyTime[1]+mu.dutyTime[1];
+    runState.motorReversals = motorUsageBase.reversals+mu.reversals;
+    runState.swingCycles = swingCyclesBase+sessionSwingCycles;
+    runState.calibrations = calibrationsBase+sessionCalibrations;
+  }
+
+
+  void usageCheckpoint()
+  {
+    const DcMotorDriver::MotorUsage &mu = motorDriver->getUsage();
+    double activity = mu.onTime[0]+mu.onTime[1]+mu.reversals+sessionSwingCycles+sessionCalibrations;
+    if (activity!=checkpointedActivity) {
+      // something has changed, save
+      LOG(LOG_INFO, "Checkpointing usage counters");
+      checkpointedActivity = activity;
+      updateLifetimeUsage();
+      runState.save();
+    }
+    MainLoop::currentMainLoop().executeTicketOnce(usageCheckpointTicket, boost::bind(&P44WiperD::usageCheckpoint, this), USAGE_CHECKPOINT_INTERVAL);
+  }
+
+
+
+  // MARK: ===== positioning
+
+
+  DcMotorDriver::PositionControlParams positionControlParams()
+  {
+    DcMotorDriver::PositionControlParams p;
+    p.gain = settings.positionGain;
+    p.damping = settings.positionDamping;
+    p.minPower = settings.positionMinPower;
+    p.maxPower = settings.positionMaxPower;
+    p.tolerance = settings.positionTolerance;
+    p.settleTime = POSITION_SETTLE_TIME;
+    return p;
+  }
+
+
+  /// drive to an angle and hold it there (run mode becomes run_position)
+  void positionTo(double aAngle, StatusCB aDoneCB)
+  {
+    if (settings.wiperType!=wiper_software) {
+      if (aDoneCB) aDoneCB(WebError::webErr(409, "positioning needs software wiper type"));
+      return;
+    }
+    if (!positionKnown() || positionEstimator->confidence()<MIN_POSITION_CONFIDENCE) {
+      if (aDoneCB) aDoneCB(WebError::webErr(409, "position unknown, find zero first"));
+      return;
+    }
+    LOG(LOG_NOTICE, "Positioning to %.1f degrees", aAngle);
+    if (opDoneCB && mvState==mv_position) endOp(TextError::err("positioning superseded by new target"));
+    stopSwing();
+    setMode(run_position);
+    startOp(aDoneCB);
+    deadlines.setIn(dl_operation, MAX_POSITIONING_TIME, boost::bind(&P44WiperD::positioningTimeout, this));
+    setMvState(mv_position);
+    DCMotorStatusCB reachedCB = boost::bind(&P44WiperD::positionReached, this);
+    if (motorDriver->isPositionControlRunning()) {
+      motorDriver->setPositionTarget(aAngle, reachedCB);
+    }
+    else {
+      motorDriver->runPositionControl(aAngle, boost::bind(&PositionEstimator::currentAngle, positionEstimator), positionControlParams(), reachedCB);
+    }
+  }
+
+
+  void positionReached()
+  {
+    LOG(LOG_NOTICE, "Position %.1f degrees reached, holding", motorDriver->getPositionTarget());
+    endOp();
+  }
+
+
+  void positioningTimeout()
+  {
+    // keep trying, but report failure
+    endOp(TextError::err("position %.1f not reached within %d seconds", motorDriver->getPositionTarget(), (int)(MAX_POSITIONING_TIME/Second)));
+  }
+
+
+  void endPositioning()
+  {
+    if (motorDriver->isPositionControlRunning()) {
+      LOG(LOG_NOTICE, "Positioning ends");
+      motorDriver->rampToPower(0, 0, -settings.haltTime, 0);
+    }
+    if (opDoneCB && mvState==mv_position) endOp(TextError::err("positioning cancelled"));
+  }
+
+
+
+  // MARK: ===== motor simulation
+
+
+  /// advance the simulated motor up to now, with the output applied since the last step
+  void simAdvance()
+  {
+    MLMicroSeconds now = MainLoop::now();
+    motorSim.step((double)(now-simLastStep)/Second, simPower, simDirection);
+    simLastStep = now;
+  }
+
+
+  void simTimer()
+  {
+    simAdvance();
+    bool z = motorSim.zeroInput();
+    if (z!=simulatedZeroPos) {
+      simulatedZeroPos = z;
+      zeroPosHandler(z);
+    }
+    MainLoop::currentMainLoop().executeTicketOnce(simTicket, boost::bind(&P44WiperD::simTimer, this), SIM_STEP_INTERVAL);
+  }
+
+
+
+  // MARK: ===== timeline preview
+
+
+  /// compute the motor output timeline for a sequence or swing settings, without touching the motor
+  ErrorPtr previewTimeline(JsonObjectPtr aData, JsonObjectPtr &aResult)
+  {
+    JsonObjectPtr o;
+    ErrorPtr err;
+    DcMotorDriver::SequenceStepList steps;
+    if (aData->get("steps", o)) {
+      err = MotionPattern::compileSteps(o, MAX_PREVIEW_STEPS, steps);
+    }
+    else if (aData->get("swing", o)) {
+      err = swingPreviewSteps(o, steps);
+    }
+    else {
+      return WebError::webErr(400, "preview needs 'steps' or 'swing'");
+    }
+    if (!Error::isOK(err)) return WebError::webErr(400, "%s", err->description().c_str());
+    double startPower = 0;
+    int startDirection = 0;
+    if (aData->get("startPower", o)) startPower = o->doubleValue();
+    if (aData->get("startDirection", o)) startDirection = o->int32Value();
+    DcMotorDriver::Timeline tl;
+    tl.maxPoints = MAX_PREVIEW_POINTS;
+    if (aData->get("maxPoints", o)) {
+      int mp = o->int32Value();
+      if (mp>=1 && mp<MAX_PREVIEW_POINTS) tl.maxPoints = mp;
+    }
+    motorDriver->previewSequence(steps, startPower, startDirection, tl);
+    aResult = JsonObject::newObj();
+    aResult->add("stepTime", JsonObject::newDouble((double)motorDriver->getRampStepTime()/Second));
+    aResult->add("duration", JsonObject::newDouble((double)tl.endTime/Second));
+    aResult->add("points", JsonObject::newInt64(tl.time.size()));
+    aResult->add("truncated", JsonObject::newBool(tl.truncated));
+    // series as comma separated strings, not one JSON object per point, to keep large previews cheap
+    string t, p, d, b;
+    size_t n = tl.time.size();
+    t.reserve(n*8); p.reserve(n*6); d.reserve(n*3); b.reserve(n*2);
+    for (size_t i=0; i<n; i++) {
+      const char *sep = i>0 ? "," : "";
+      string_format_append(t, "%s%.3f", sep, tl.time[i]);
+      string_format_append(p, "%s%.2f", sep, tl.power[i]);
+      string_format_append(d, "%s%d", sep, tl.direction[i]);
+      b.append(sep);
+      b.append(tl.brake[i] ? "1" : "0");
+    }
+    aResult->add("time", JsonObject::newString(t));
+    aResult->add("power", JsonObject::newString(p));
+    aResult->add("direction", JsonObject::newString(d));
+    aResult->add("brake", JsonObject::newString(b));
+    return ErrorPtr();
+  }
+
+
+  /// build the ramps the built-in swing issues, with optional settings overrides, assuming
+  /// the midpoint is reached exactly at the end of each acceleration ramp
+  ErrorPtr swingPreviewSteps(JsonObjectPtr aParams, DcMotorDriver::SequenceStepList &aSteps)
+  {
+    WiperSettings s = settings;
+    JsonObjectPtr o;
+    int cycles = 1;
+    if (aParams->get("cycles", o)) cycles = o->int32Value();
+    if (cycles<1) cycles = 1;
+    else if (cycles>MAX_PREVIEW_CYCLES) cycles = MAX_PREVIEW_CYCLES;
+    for (int i=0; i<numSettingsFields; i++) {
+      const SettingsFieldDef &fdef = settingsFieldDefs[i];
+      if (aParams->get(fdef.fieldName, o)) {
+        double v = o->doubleValue();
+        if (v>fdef.max) v = fdef.max;
+        else if (v<fdef.min) v = fdef.min;
+        if (fdef.jsonType==json_type_double) *((double *)((char *)&s+fdef.offset)) = v;
+        else if (fdef.jsonType==json_type_int) *((int *)((char *)&s+fdef.offset)) = (int)v;
+      }
+    }
+    DcMotorDriver::SequenceStep step;
+    step.runTime = 0;
+    if (s.wiperType==wiper_mechanical) {
+      // mechanical wiper just runs
+      step.power = s.swingMaxPower; step.direction = 1; step.rampTime = -s.haltTime; step.rampExp = 0; step.profile = DcMotorDriver::ramp_exp;
+      aSteps.push_back(step);
+      return ErrorPtr();
+    }
+    if (s.swingCurveType>=2) return TextError::err("waveform swing (swingCurveType %d) is not made of ramps", s.swingCurveType);
+    step.profile = s.swingCurveType==1 ? DcMotorDriver::ramp_scurve : DcMotorDriver::ramp_exp;
+    for (int c=0; c<cycles; c++) {
+      for (int dir=1; dir>=-1; dir-=2) {
+        // accelerate, midpoint adjust, decelerate, change direction (see swingAccelerate() etc.)
+        step.direction = dir;
+        step.power = s.swingMaxPower; step.rampTime = s.swingPeriod/2; step.rampExp = s.swingCurveExp;
+        aSteps.push_back(step);
+        step.power = s.swingMaxPower; step.rampTime = s.midPointAdjustTime; step.rampExp = 0;
+        aSteps.push_back(step);
+        step.power = s.swingMinPower; step.rampTime = s.swingPeriod/2; step.rampExp = -s.swingCurveExp;
+        aSteps.push_back(step);
+        step.direction = -dir;
+        step.power = s.swingMinPower; step.rampTime = s.dirChangeTime; step.rampExp = 0;
+        aSteps.push_back(step);
+      }
+    }
+    return ErrorPtr();
+  }
+
+
+
   // MARK: ===== API access
 
 
@@ -1006,6 +1901,7 @@ public:
 
   void apiRequestHandler(JsonCommPtr aConnection, ErrorPtr aError, JsonObjectPtr aRequest)
   {
+    MLMicroSeconds start = MainLoop::now();
     // Decode mg44-style request (HTTP wrapped in JSON)
     if (Error::isOK(aError)) {
       LOG(LOG_INFO,"API request: %s", aRequest->c_strValue());
@@ -1028,7 +1924,10 @@ public:
           if (data) action = true; // GET, but with query_params: treat like PUT/POST with data
         }
         // request elements now: uri and data
-        if (processRequest(uri, data, action, boost::bind(&P44WiperD::requestHandled, this, aConnection, _1, _2))) {
+        int ep = 0;
+        while (ep<numApiEndpoints-1 && uri!=apiEndpoints[ep]) ep++;
+        apiRequests[ep]++;
+        if (processRequest(uri, data, action, boost::bind(&P44WiperD::requestHandled, this, aConnection, start, _1, _2))) {
           // done, callback will send response and close connection
           return;
         }
@@ -1042,12 +1941,13 @@ public:
       }
     }
     // return error
-    requestHandled(aConnection, JsonObjectPtr(), aError);
+    requestHandled(aConnection, start, JsonObjectPtr(), aError);
   }
 
 
-  void requestHandled(JsonCommPtr aConnection, JsonObjectPtr aResponse, ErrorPtr aError)
+  void requestHandled(JsonCommPtr aConnection, MLMicroSeconds aStartTime, JsonObjectPtr aResponse, ErrorPtr aError)
   {
+    apiLatency.add(MainLoop::now()-aStartTime);
     if (!aResponse) {
       aResponse = JsonObject::newObj(); // empty response
     }
@@ -1060,44 +1960,6 @@ public:
   }
 
 
-  JsonObjectPtr fieldAsJSON(const SettingsFieldDef &aFdef)
-  {
-    JsonObjectPtr val;
-    switch (aFdef.jsonType) {
-      case json_type_boolean: val = JsonObject::newBool(FLD(bool, aFdef.offset)); break;
-      case json_type_double: val = JsonObject::newDouble(FLD(double, aFdef.offset)); break;
-      case json_type_int: val = JsonObject::newInt64(FLD(int, aFdef.offset)); break;
-      case json_type_string: val = val = JsonObject::newString(FLD(string, aFdef.offset)); break;
-      default: val = JsonObject::newNull(); break;
-    }
-    return val;
-  }
-
-
-  void JSONtoField(const SettingsFieldDef &aFdef, JsonObjectPtr aValue)
-  {
-    switch (aFdef.jsonType) {
-      case json_type_boolean: FLD(bool, aFdef.offset) = aValue->boolValue(); break;
-      case json_type_double: {
-        double v = aValue->doubleValue();
-        if (v>aFdef.max) v = aFdef.max;
-        else if (v<aFdef.min) v = aFdef.min;
-        FLD(double, aFdef.offset) = v;
-        break;
-      }
-      case json_type_int: {
-        int v = aValue->int32Value();
-        if (v>aFdef.max) v = aFdef.max;
-        else if (v<aFdef.min) v = aFdef.min;
-        FLD(int, aFdef.offset) = v;
-        break;
-      }
-      case json_type_string: FLD(string, aFdef.offset) = aValue->stringValue(); break;
-      default: break;
-    }
-  }
-
-
   bool processRequest(string aUri, JsonObjectPtr aData, bool aIsAction, RequestDoneCB aRequestDoneCB)
   {
     ErrorPtr err;
@@ -1105,66 +1967,40 @@ public:
     JsonObjectPtr res;
     if (aUri=="settings") {
       // access settings
-      string fieldName;
-      if (aIsAction && aData->get("action", o)) {
-        // settings actions
-        string a = o->stringValue();
-        if (a=="save") {
-          save();
-        }
-        else if (a=="reload") {
-          load();
-          markDirty(); // potentially changed
-        }
-        else if (a=="defaults") {
-          default_settings();
-          markDirty(); // potentially changed
-        }
-        actionDone(aRequestDoneCB);
-      }
-      else if (aData->get("field", o)) {
-        fieldName = o->stringValue();
-        // single field access
-        for (int i=0; i<numSettingsFields; i++) {
-          const SettingsFieldDef &fdef = settingsFieldDefs[i];
-          if (fieldName==fdef.fieldName) {
-            if (aData->get("value", o)) {
-              // write
-              JSONtoField(fdef, o);
-              markDirty();
-            }
-            else {
-              // read
-              res = fieldAsJSON(fdef);
-            }
-            break;
-          }
-        }
-      }
-      else {
-        // return all fields
-        res = JsonObject::newObj();
-        for (int i=0; i<numSettingsFields; i++) {
-          const SettingsFieldDef &fdef = settingsFieldDefs[i];
-          JsonObjectPtr fld = JsonObject::newObj();
-          fld->add("title", JsonObject::newString(fdef.title));
-          if (fdef.jsonType==json_type_double) {
-            fld->add("min", JsonObject::newDouble(fdef.min));
-            fld->add("max", JsonObject::newDouble(fdef.max));
-            if (fdef.res!=0) fld->add("res", JsonObject::newDouble(fdef.res));
-            fld->add("def", JsonObject::newDouble(fdef.def));
-          }
-          else if (fdef.jsonType==json_type_int) {
-            fld->add("min", JsonObject::newInt64(fdef.min));
-            fld->add("max", JsonObject::newInt64(fdef.max));
-            if (fdef.res!=0) fld->add("res", JsonObject::newInt64(fdef.res));
-            fld->add("def", JsonObject::newInt64(fdef.def));
-          }
-          fld->add("value", fieldAsJSON(fdef));
-          res->add(fdef.fieldName, fld);
-        }
-      }
-      aRequestDoneCB(res, ErrorPtr());
+      err = settings.processRequest(aData, aIsAction, res);
+      if (aIsAction) settingsChanged();
+      aRequestDoneCB(res, err);
+      return true;
+    }
+    else if (aUri=="status") {
+      aRequestDoneCB(statusAsJSON(), ErrorPtr());
+      return true;
+    }
+    else if (aUri=="patterns") {
+      // access motion patterns
+      err = patterns.processRequest(aData, aIsAction, res);
+      aRequestDoneCB(res, err);
+      return true;
+    }
+    else if (aUri=="schedule") {
+      // access operating schedule
+      err = schedule.processRequest(aData, aIsAction, res);
+      aRequestDoneCB(res, err);
+      return true;
+    }
+    else if (aUri=="metrics") {
+      JsonObjectPtr m = JsonObject::newObj();
+      m->add("text", JsonObject::newString(metricsText()));
+      aRequestDoneCB(m, ErrorPtr());
+      return true;
+    }
+    else if (aUri=="usage") {
+      aRequestDoneCB(usageAsJSON(), ErrorPtr());
+      return true;
+    }
+    else if (aIsAction && aUri=="preview") {
+      err = previewTimeline(aData, res);
+      aRequestDoneCB(res, err);
       return true;
     }
     else if (aIsAction && aUri=="log") {
@@ -1174,6 +2010,9 @@ public:
         SETLOGLEVEL(lvl);
         actionDone(aRequestDoneCB);
       }
+      else {
+        aRequestDoneCB(JsonObjectPtr(), WebError::webErr(400, "missing 'level'"));
+      }
       return true;
     }
     else if (aUri=="operation") {
@@ -1203,6 +2042,21 @@ public:
           calibrate(boost::bind(&P44WiperD::actionStatus, this, aRequestDoneCB, _1));
           return true;
         }
+        else if (a=="position") {
+          // drive to and hold an angle, answer when reached
+          if (!aData->get("angle", o)) {
+            aRequestDoneCB(JsonObjectPtr(), WebError::webErr(400, "missing 'angle'"));
+          }
+          else {
+            positionTo(o->doubleValue(), boost::bind(&P44WiperD::actionStatus, this, aRequestDoneCB, _1));
+          }
+          return true;
+        }
+        else if (a=="autotune") {
+          // runs unattended, progress is visible in status
+          actionStatus(aRequestDoneCB, startAutotune(aData));
+          return true;
+        }
       }
     }
     // cannot process request
@@ -1210,160 +2064,78 @@ public:
   }
 
 
-  void actionDone(RequestDoneCB aRequestDoneCB)
-  {
-    aRequestDoneCB(JsonObjectPtr(), ErrorPtr());
-  }
-
-
-  void actionStatus(RequestDoneCB aRequestDoneCB, ErrorPtr aError = ErrorPtr())
-  {
-    aRequestDoneCB(JsonObjectPtr(), aError);
-  }
-
-
-
-
-  void logParams()
-  {
-    for (int i=0; i<numSettingsFields; i++) {
-      const SettingsFieldDef &fdef = settingsFieldDefs[i];
-      string s;
-      switch (fdef.jsonType) {
-        case json_type_boolean: s = string_format("%s", FLD(bool, fdef.offset) ? "true" : "false"); break;
-        case json_type_double: s = string_format("%.3f", FLD(double, fdef.offset)); break;
-        case json_type_int: s = string_format("%d", FLD(int, fdef.offset)); break;
-        case json_type_string: s = string_format("'%s'", FLD(string, fdef.offset).c_str()); break;
-        default: s = "<unknown>"; break;
-      }
-      LOG(LOG_INFO, "%s = %s  (%s)", fdef.fieldName, s.c_str(), fdef.title);
-    }
-  }
-
-
-
-
-
-  // MARK: ===== persistence implementation
-
-
-  ErrorPtr load()
-  {
-    return loadFromStore(NULL);
-  }
-
-
-  void saveChanges()
-  {
-    markDirty();
-    save();
-  }
-
-
-  void save()
-  {
-    ErrorPtr err = saveToStore(NULL, false);
-    if (!Error::isOK(err)) {
-      LOG(LOG_ERR, "cannot save params: %s", err->description().c_str());
+  JsonObjectPtr statusAsJSON()
+  {
+    JsonObjectPtr st = JsonObject::newObj();
+    st->add("mvState", JsonObject::newInt64(mvState));
+    st->add("runMode", JsonObject::newInt64(runMode));
+    st->add("swinging", JsonObject::newBool(swinging));
+    st->add("preArmed", JsonObject::newBool(preArmed));
+    st->add("power", JsonObject::newDouble(motorDriver->getCurrentPower()));
+    st->add("direction", JsonObject::newInt64(motorDriver->getCurrentDirection()));
+    st->add("angle", JsonObject::newDouble(positionEstimator->currentAngle()));
+    st->add("angleConfidence", JsonObject::newDouble(positionEstimator->confidence()));
+    st->add("lastAnchorError", JsonObject::newDouble(positionEstimator->getLastAnchorError()));
+    st->add("watchdog", watchdog->statusAsJSON());
+    st->add("deadlines", deadlines.statusAsJSON());
+    st->add("autotune", swingTuner.statusAsJSON());
+    if (motorDriver->isPositionControlRunning()) {
+      st->add("positionTarget", JsonObject::newDouble(motorDriver->getPositionTarget()));
     }
-  }
-
-
-  void default_settings()
-  {
-    for (int i=0; i<numSettingsFields; i++) {
-      const SettingsFieldDef &fdef = settingsFieldDefs[i];
-      switch (fdef.jsonType) {
-        case json_type_boolean: FLD(bool, fdef.offset) = fdef.def>0; break;
-        case json_type_double: FLD(double, fdef.offset) = fdef.def; break;
-        case json_type_int: FLD(int, fdef.offset) = fdef.def; break;
-        default: break; // cannot initialize other types
-      }
+    if (simulateMotor) {
+      st->add("simulatedAngle", JsonObject::newDouble(motorSim.currentAngle()));
     }
+    const DcMotorDriver::OutputWrites &ow = motorDriver->getOutputWrites();
+    JsonObjectPtr w = JsonObject::newObj();
+    w->add("issued", JsonObject::newInt64(ow.issued));
+    w->add("suppressed", JsonObject::newInt64(ow.suppressed));
+    st->add("outputWrites", w);
+    const DurationSummary &rl = motorDriver->getRampStepLatency();
+    JsonObjectPtr l = JsonObject::newObj();
+    l->add("count", JsonObject::newInt64(rl.count));
+    l->add("sum", JsonObject::newDouble(rl.sum));
+    l->add("max", JsonObject::newDouble(rl.max));
+    st->add("rampStepLatency", l);
+    return st;
   }
 
 
-
-
-
-
-  // SQLIte3 table name to store these parameters to
-  const char *tableName()
-  {
-    return "WiperSettings";
-  }
-
-
-  // data field definitions
-
-  size_t numFieldDefs()
-  {
-    return inheritedParams::numFieldDefs()+numSettingsFields;
-  }
-
-
-  const FieldDefinition *getFieldDef(size_t aIndex)
-  {
-    static FieldDefinition fdef; // Warning: not thread safe
-
-    if (aIndex<inheritedParams::numFieldDefs())
-      return inheritedParams::getFieldDef(aIndex);
-    aIndex -= inheritedParams::numFieldDefs();
-    if (aIndex<numSettingsFields) {
-      fdef.fieldName = settingsFieldDefs[aIndex].fieldName;
-      switch (settingsFieldDefs[aIndex].jsonType) {
-        case json_type_boolean: fdef.dataTypeCode = SQLITE_INTEGER; break;
-        case json_type_double: fdef.dataTypeCode = SQLITE_FLOAT; break;
-        case json_type_int: fdef.dataTypeCode = SQLITE_INTEGER; break;
-        case json_type_string: fdef.dataTypeCode = SQLITE_TEXT; break;
-        default: fdef.dataTypeCode = SQLITE_TEXT; break;
-      }
-      return &fdef;
-    }
-    return NULL;
+  JsonObjectPtr usageAsJSON()
+  {
+    JsonObjectPtr u = JsonObject::newObj();
+    const DcMotorDriver::MotorUsage &mu = motorDriver->getUsage();
+    JsonObjectPtr s = JsonObject::newObj();
+    s->add("motorOnTimeCW", JsonObject::newDouble(mu.onTime[0]));
+    s->add("motorOnTimeCCW", JsonObject::newDouble(mu.onTime[1]));
+    s->add("motorDutyTimeCW", JsonObject::newDouble(mu.dutyTime[0]));
+    s->add("motorDutyTimeCCW", JsonObject::newDouble(mu.dutyTime[1]));
+    s->add("motorReversals", JsonObject::newInt64(mu.reversals));
+    s->add("swingCycles", JsonObject::newInt64(sessionSwingCycles));
+    s->add("calibrations", JsonObject::newInt64(sessionCalibrations));
+    u->add("session", s);
+    updateLifetimeUsage();
+    JsonObjectPtr l = JsonObject::newObj();
+    l->add("motorOnTimeCW", JsonObject::newDouble(runState.motorOnTimeCW));
+    l->add("motorOnTimeCCW", JsonObject::newDouble(runState.motorOnTimeCCW));
+    l->add("motorDutyTimeCW", JsonObject::newDouble(runState.motorDutyTimeCW));
+    l->add("motorDutyTimeCCW", JsonObject::newDouble(runState.motorDutyTimeCCW));
+    l->add("motorReversals", JsonObject::newInt64(runState.motorReversals));
+    l->add("swingCycles", JsonObject::newInt64(runState.swingCycles));
+    l->add("calibrations", JsonObject::newInt64(runState.calibrations));
+    u->add("lifetime", l);
+    return u;
   }
 
 
-  /// load values from passed row
-  void loadFromRow(sqlite3pp::query::iterator &aRow, int &aIndex, uint64_t *aCommonFlagsP)
+  void actionDone(RequestDoneCB aRequestDoneCB)
   {
-    inheritedParams::loadFromRow(aRow, aIndex, aCommonFlagsP);
-    for (int i=0; i<numSettingsFields; i++) {
-      const SettingsFieldDef &fdef = settingsFieldDefs[i];
-      switch (fdef.jsonType) {
-        case json_type_boolean: aRow->getIfNotNull(aIndex, FLD(bool, fdef.offset)); break;
-        case json_type_double: aRow->getIfNotNull(aIndex, FLD(double, fdef.offset)); break;
-        case json_type_int: aRow->getIfNotNull(aIndex, FLD(int, fdef.offset)); break;
-        case json_type_string: {
-          const char *s;
-          if (aRow->getIfNotNull(aIndex, s)) {
-            FLD(bool, fdef.offset) = s;
-          }
-          break;
-        }
-        default: break; // ignore others
-      }
-      aIndex++;
-    }
+    aRequestDoneCB(JsonObjectPtr(), ErrorPtr());
   }
 
 
-  // bind values to passed statement
-  void bindToStatement(sqlite3pp::statement &aStatement, int &aIndex, const char *aParentIdentifier, uint64_t aCommonFlags)
+  void actionStatus(RequestDoneCB aRequestDoneCB, ErrorPtr aError = ErrorPtr())
   {
-    inheritedParams::bindToStatement(aStatement, aIndex, aParentIdentifier, aCommonFlags);
-    // bind the fields
-    for (int i=0; i<numSettingsFields; i++) {
-      const SettingsFieldDef &fdef = settingsFieldDefs[i];
-      switch (fdef.jsonType) {
-        case json_type_boolean: aStatement.bind(aIndex, FLD(bool, fdef.offset)); break;
-        case json_type_double: aStatement.bind(aIndex, FLD(double, fdef.offset)); break;
-        case json_type_int: aStatement.bind(aIndex, FLD(int, fdef.offset)); break;
-        case json_type_string: aStatement.bind(aIndex, FLD(string, fdef.offset).c_str(), false); break;
-        default: aStatement.bind(aIndex); // just bind NULL to unknown types
-      }
-      aIndex++;
-    }
+    aRequestDoneCB(JsonObjectPtr(), aError);
   }
 
 
@@ -0,0 +1,110 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Minimal reader for the p44wiperd shared memory status block (see wiperstatusblock.h).
+// Deliberately has no p44utils dependencies. Prints one JSON object per line to stdout.
+
+#include "wiperstatusblock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#define DEFAULT_STATUSBLOCK "/dev/shm/p44wiperd.status"
+#define READ_TRIES 1000
+
+
+static void usage(const char *aName)
+{
+  fprintf(stderr,
+    "Usage: %s [-i interval_ms] [-n count] [statusblock]\n"
+    "  statusblock : path of the status block file (default = " DEFAULT_STATUSBLOCK ")\n"
+    "  -i interval_ms : poll repeatedly at this interval (default: read once)\n"
+    "  -n count : stop after count reads (default: unlimited when polling)\n",
+    aName
+  );
+}
+
+
+int main(int argc, char **argv)
+{
+  long interval = 0;
+  long count = -1;
+  int c;
+  while ((c = getopt(argc, argv, "i:n:h"))!=-1) {
+    switch (c) {
+      case 'i': interval = atol(optarg); break;
+      case 'n': count = atol(optarg); break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  const char *path = optind<argc ? argv[optind] : DEFAULT_STATUSBLOCK;
+  if (interval<=0) count = 1;
+  // map
+  int fd = open(path, O_RDONLY);
+  if (fd<0) {
+    perror(path);
+    return EXIT_FAILURE;
+  }
+  void *m = mmap(NULL, sizeof(WiperStatusBlock), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m==MAP_FAILED) {
+    perror("mmap");
+    return EXIT_FAILURE;
+  }
+  const WiperStatusBlock *block = (const WiperStatusBlock *)m;
+  if (block->magic!=WIPER_STATUSBLOCK_MAGIC || block->version!=WIPER_STATUSBLOCK_VERSION || block->dataSize!=sizeof(WiperStatusData)) {
+    fprintf(stderr, "%s: not a compatible p44wiperd status block\n", path);
+    return EXIT_FAILURE;
+  }
+  // read
+  while (count!=0) {
+    WiperStatusData d;
+    if (!wiperStatusRead(block, &d, READ_TRIES)) {
+      fprintf(stderr, "no consistent status after %d tries\n", READ_TRIES);
+      return EXIT_FAILURE;
+    }
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t now = (int64_t)tv.tv_sec*1000000+tv.tv_usec;
+    printf(
+      "{\"alive\":%s,\"age\":%.6f,\"power\":%.2f,\"direction\":%d,\"mvState\":%d,\"runMode\":%d,\"swinging\":%s,"
+      "\"runRemaining\":%.3f,\"swingCycles\":%lld,\"motorReversals\":%lld,\"movementTriggers\":%lld,"
+      "\"calibrations\":%lld,\"zeroFindFailures\":%lld}\n",
+      d.alive ? "true" : "false",
+      (double)(now-d.publishedAt)/1E6,
+      d.power, d.direction, d.mvState, d.runMode,
+      d.swinging ? "true" : "false",
+      d.runUntil>now ? (double)(d.runUntil-now)/1E6 : 0.0,
+      (long long)d.swingCycles, (long long)d.motorReversals, (long long)d.movementTriggers,
+      (long long)d.calibrations, (long long)d.zeroFindFailures
+    );
+    fflush(stdout);
+    if (count>0) count--;
+    if (count!=0) usleep(interval*1000);
+  }
+  munmap(m, sizeof(WiperStatusBlock));
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "positionestimator.hpp"
+
+#include <math.h>
+
+using namespace p44;
+
+
+#define CONFIDENCE_TRAVEL_SCALE 720 // travel in degrees after which confidence has dropped to 1/e
+#define WATCH_TOLERANCE 0.5 // degrees
+
+
+static double normalizedAngle(double aAngle)
+{
+  aAngle = fmod(aAngle, 360);
+  if (aAngle>180) aAngle -= 360;
+  else if (aAngle<=-180) aAngle += 360;
+  return aAngle;
+}
+
+
+PositionEstimator::PositionEstimator() :
+  degreesPerSecondPerPercent(0),
+  anchored(false),
+  angle(0),
+  travel(0),
+  initialUncertainty(0),
+  lastAnchorError(0),
+  power(0),
+  direction(0),
+  lastUpdate(Never),
+  watchTarget(0),
+  watchTravelled(0),
+  watchTicket(0)
+{
+}
+
+
+PositionEstimator::~PositionEstimator()
+{
+  cancelWatch();
+}
+
+
+void PositionEstimator::setCalibration(double aRotationTime, double aPower)
+{
+  integrate(); // up to now, with old calibration
+  if (aRotationTime>0 && aPower>0) {
+    degreesPerSecondPerPercent = 360/aRotationTime/aPower;
+  }
+  else {
+    degreesPerSecondPerPercent = 0;
+  }
+  armWatch(); // speed might have changed
+}
+
+
+void PositionEstimator::integrate()
+{
+  MLMicroSeconds now = MainLoop::now();
+  if (lastUpdate!=Never && direction!=0 && power>0) {
+    double d = (double)(now-lastUpdate)/Second*power*degreesPerSecondPerPercent;
+    angle = normalizedAngle(angle + direction*d);
+    travel += d;
+    watchTravelled += d;
+  }
+  lastUpdate = now;
+}
+
+
+void PositionEstimator::motorChanged(double aPower, int aDirection)
+{
+  integrate(); // with previous power
+  power = aPower;
+  direction = aPower>0 ? aDirection : 0;
+  armWatch();
+}
+
+
+void PositionEstimator::anchorAtZero()
+{
+  integrate();
+  if (anchored) {
+    lastAnchorError = angle;
+    LOG(LOG_DEBUG, "Position estimate re-anchored at zero, error was %.1f degrees after %.1f degrees travel", angle, travel);
+  }
+  anchored = true;
+  angle = 0;
+  travel = 0;
+  initialUncertainty = 0;
+}
+
+
+void PositionEstimator::invalidate()
+{
+  integrate();
+  anchored = false;
+  angle = 0;
+  travel = 0;
+}
+
+
+void PositionEstimator::setEstimate(double aAngle, double aConfidence)
+{
+  integrate();
+  if (aConfidence<=0) {
+    invalidate();
+    return;
+  }
+  if (aConfidence>1) aConfidence = 1;
+  anchored = true;
+  angle = normalizedAngle(aAngle);
+  travel = 0;
+  initialUncertainty = -log(aConfidence)*CONFIDENCE_TRAVEL_SCALE;
+}
+
+
+double PositionEstimator::currentAngle()
+{
+  integrate();
+  return angle;
+}
+
+
+double PositionEstimator::confidence()
+{
+  if (!anchored) return 0;
+  integrate();
+  return exp(-(travel+initialUncertainty)/CONFIDENCE_TRAVEL_SCALE);
+}
+
+
+double PositionEstimator::speed()
+{
+  return direction*power*degreesPerSecondPerPercent;
+}
+
+
+double PositionEstimator::travelTo(double aAngle, int aDirection)
+{
+  double d = (aAngle-currentAngle())*(aDirection<0 ? -1 : 1);
+  d = fmod(d, 360);
+  if (d<0) d += 360;
+  return d;
+}
+
+
+void PositionEstimator::watchTravel(double aDegrees, SimpleCB aTravelledCB)
+{
+  integrate();
+  watchTarget = aDegrees;
+  watchTravelled = 0;
+  watchCB = aTravelledCB;
+  armWatch();
+}
+
+
+void PositionEstimator::cancelWatch()
+{
+  watchCB = NULL;
+  MainLoop::currentMainLoop().cancelExecutionTicket(watchTicket);
+}
+
+
+void PositionEstimator::armWatch()
+{
+  if (!watchCB) return;
+  double v = fabs(speed());
+  if (v>0) {
+    double remaining = watchTarget-watchTravelled;
+    if (remaining<0) remaining = 0;
+    MainLoop::currentMainLoop().executeTicketOnce(watchTicket, boost::bind(&PositionEstimator::watchTimer, this), remaining/v*Second);
+  }
+  else {
+    // not moving, wait for next motor change
+    MainLoop::currentMainLoop().cancelExecutionTicket(watchTicket);
+  }
+}
+
+
+void PositionEstimator::watchTimer()
+{
+  watchTicket = 0;
+  integrate();
+  if (watchTarget-watchTravelled<=WATCH_TOLERANCE) {
+    SimpleCB cb = watchCB;
+    watchCB = NULL;
+    if (cb) cb();
+    return;
+  }
+  armWatch();
+}
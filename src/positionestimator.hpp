@@ -0,0 +1,121 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44wiperd__positionestimator__
+#define __p44wiperd__positionestimator__
+
+#include "p44utils_common.hpp"
+
+using namespace std;
+
+namespace p44 {
+
+
+  class PositionEstimator;
+  typedef boost::intrusive_ptr<PositionEstimator> PositionEstimatorPtr;
+
+  /// Dead reckoning estimator for the angular position of the wiper arm.
+  /// Integrates the commanded motor power over time, assuming speed is proportional to power
+  /// (as measured by calibration), and re-anchors at the zero position.
+  /// Angles are in degrees, 0 = zero position, positive = clockwise, normalized to -180..180
+  class PositionEstimator : public P44Obj
+  {
+    typedef P44Obj inherited;
+
+    double degreesPerSecondPerPercent; ///< calibrated speed
+    bool anchored; ///< set if estimate is based on a zero position anchor
+    double angle; ///< angle at lastUpdate
+    double travel; ///< absolute travel in degrees since last anchor, at lastUpdate
+    double initialUncertainty; ///< uncertainty (in degrees of travel) already present at anchoring
+    double lastAnchorError; ///< estimation error found at last re-anchoring
+    double power; ///< current power 0..100
+    int direction; ///< current direction 1=CW, -1=CCW, 0=stopped
+    MLMicroSeconds lastUpdate;
+
+    double watchTarget; ///< travel to watch for
+    double watchTravelled; ///< travel since start of watch
+    SimpleCB watchCB; ///< called when watched travel is reached
+    long watchTicket;
+
+  public:
+
+    PositionEstimator();
+    virtual ~PositionEstimator();
+
+    /// set calibration data
+    /// @param aRotationTime time for one full rotation at aPower
+    /// @param aPower the power at which aRotationTime was measured, 0..100
+    void setCalibration(double aRotationTime, double aPower);
+
+    /// to be called whenever the motor power or direction changes
+    /// @param aPower new power 0..100
+    /// @param aDirection new direction 1=CW, -1=CCW, 0=stopped
+    void motorChanged(double aPower, int aDirection);
+
+    /// to be called at a zero position edge: sets the estimate to 0 with full confidence
+    void anchorAtZero();
+
+    /// forget about the position (confidence 0)
+    void invalidate();
+
+    /// set an estimate from elsewhere, such as from persistent storage
+    /// @param aAngle angle in degrees
+    /// @param aConfidence confidence for the angle, 0..1
+    void setEstimate(double aAngle, double aConfidence);
+
+    /// @return current angle estimate in degrees (-180..180)
+    double currentAngle();
+
+    /// @return confidence of the current angle estimate: 1 = just anchored, decays with travel, 0 = unknown
+    double confidence();
+
+    /// @return current (model) angular speed in degrees per second, signed (positive = clockwise)
+    double speed();
+
+    /// @return travel in given direction needed to reach the given angle, in degrees (0..360)
+    /// @param aAngle target angle
+    /// @param aDirection direction of travel 1=CW, -1=CCW
+    double travelTo(double aAngle, int aDirection);
+
+    /// get notified when the arm has travelled given angle from now on (in any direction, based on estimate)
+    /// @param aDegrees the absolute travel in degrees
+    /// @param aTravelledCB called when estimated travel reaches aDegrees.
+    /// @note only one watch can be active at a time, setting a new one cancels the previous one
+    void watchTravel(double aDegrees, SimpleCB aTravelledCB);
+
+    /// cancel travel watch, if any
+    void cancelWatch();
+
+    /// @return estimation error in degrees found at the last re-anchoring at zero position
+    double getLastAnchorError() { return lastAnchorError; };
+
+  private:
+
+    void integrate();
+    void armWatch();
+    void watchTimer();
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__positionestimator__) */
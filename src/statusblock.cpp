@@ -0,0 +1,96 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "statusblock.hpp"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+
+using namespace p44;
+
+
+StatusBlockPublisher::StatusBlockPublisher() :
+  fd(-1),
+  block(NULL)
+{
+  memset(&last, 0, sizeof(last));
+}
+
+
+StatusBlockPublisher::~StatusBlockPublisher()
+{
+  close();
+}
+
+
+ErrorPtr StatusBlockPublisher::open(const string &aPath)
+{
+  close();
+  path = aPath;
+  fd = ::open(path.c_str(), O_RDWR|O_CREAT, 0644);
+  if (fd<0) return SysError::errNo("cannot open status block: ");
+  if (ftruncate(fd, sizeof(WiperStatusBlock))<0) {
+    ErrorPtr err = SysError::errNo("cannot size status block: ");
+    ::close(fd); fd = -1;
+    return err;
+  }
+  void *m = mmap(NULL, sizeof(WiperStatusBlock), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (m==MAP_FAILED) {
+    ErrorPtr err = SysError::errNo("cannot map status block: ");
+    ::close(fd); fd = -1;
+    return err;
+  }
+  block = (WiperStatusBlock *)m;
+  // header: a reused file keeps its seq, so readers that have it mapped never see seq go backwards
+  if (block->seq & 1) block->seq++; // previous writer died while writing
+  block->magic = WIPER_STATUSBLOCK_MAGIC;
+  block->version = WIPER_STATUSBLOCK_VERSION;
+  block->dataSize = sizeof(WiperStatusData);
+  LOG(LOG_INFO, "Publishing status block in %s", path.c_str());
+  return ErrorPtr();
+}
+
+
+void StatusBlockPublisher::publish(const WiperStatusData &aData)
+{
+  if (!block) return;
+  last = aData;
+  last.publishedAt = MainLoop::unixtime();
+  last.alive = 1;
+  wiperStatusWrite(block, &last);
+}
+
+
+void StatusBlockPublisher::close()
+{
+  if (block) {
+    last.publishedAt = MainLoop::unixtime();
+    last.alive = 0;
+    wiperStatusWrite(block, &last);
+    munmap(block, sizeof(WiperStatusBlock));
+    block = NULL;
+  }
+  if (fd>=0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
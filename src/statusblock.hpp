@@ -0,0 +1,72 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __p44wiperd__statusblock__
+#define __p44wiperd__statusblock__
+
+#include "p44utils_common.hpp"
+
+#include "wiperstatusblock.h"
+
+using namespace std;
+
+namespace p44 {
+
+
+  class StatusBlockPublisher;
+  typedef boost::intrusive_ptr<StatusBlockPublisher> StatusBlockPublisherPtr;
+
+  /// Publishes the wiper status into a memory mapped file (usually on tmpfs, e.g. in /dev/shm),
+  /// so local processes can poll it without syscalls and without loading the daemon.
+  /// See wiperstatusblock.h for the layout and the consistency protocol.
+  class StatusBlockPublisher : public P44Obj
+  {
+    typedef P44Obj inherited;
+
+    string path;
+    int fd;
+    WiperStatusBlock *block;
+    WiperStatusData last; ///< last published data
+
+  public:
+
+    StatusBlockPublisher();
+    virtual ~StatusBlockPublisher();
+
+    /// create (or re-use) and map the status block file
+    /// @param aPath path of the file
+    /// @return ok or error
+    ErrorPtr open(const string &aPath);
+
+    /// publish new status
+    /// @param aData the status, publishedAt and alive are set by publish()
+    void publish(const WiperStatusData &aData);
+
+    /// mark the status as no longer alive and unmap the block (the file is left for readers to see)
+    void close();
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__statusblock__) */
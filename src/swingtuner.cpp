@@ -0,0 +1,304 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "swingtuner.hpp"
+
+#include <math.h>
+
+using namespace p44;
+
+
+#define SETTLE_HALF_SWINGS 2 // half swings after a parameter change that are not measured
+#define INITIAL_STEP_RESOLUTIONS 5 // initial search step, in units of the field's resolution
+#define MISSED_MIDPOINT_WEIGHT 1.0 // cost of a trial where no midpoint was detected (all simulated)
+#define MAX_SEARCH_MOVES 100 // safety limit for skipping impossible candidates
+
+// the tuned settings, in search order
+static const char *tunedFieldNames[] = { "swingMaxPower", "swingMinPower", "swingPeriod", "swingCurveExp" };
+
+
+SwingTuner::SwingTuner(WiperSettings &aSettings) :
+  settings(aSettings),
+  targetAmplitude(0),
+  targetPeriod(0),
+  cyclesPerTrial(3),
+  maxTrials(20),
+  active(false),
+  trials(0),
+  bestCost(0),
+  param(0),
+  stepSign(0),
+  halfSwings(0),
+  accelStart(Never),
+  midpoints(0),
+  detectedMidpoints(0),
+  midpointDelaySum(0),
+  amplitudeSum(0),
+  amplitudeSamples(0),
+  periodSum(0),
+  periodSamples(0),
+  lastCost(-1),
+  lastAmplitude(0),
+  lastPeriod(0),
+  lastDetectedRatio(0),
+  lastMidpointDelay(0)
+{
+  for (int p=0; p<numTunedParams; p++) {
+    fieldDefs[p] = NULL;
+    for (int i=0; i<numSettingsFields; i++) {
+      if (strcmp(settingsFieldDefs[i].fieldName, tunedFieldNames[p])==0) {
+        fieldDefs[p] = &settingsFieldDefs[i];
+        break;
+      }
+    }
+    assert(fieldDefs[p]);
+  }
+}
+
+
+double &SwingTuner::value(int aParam)
+{
+  return *((double *)((uint8_t *)&settings+fieldDefs[aParam]->offset));
+}
+
+
+void SwingTuner::applyValues(const double *aValues)
+{
+  for (int p=0; p<numTunedParams; p++) value(p) = aValues[p];
+}
+
+
+ErrorPtr SwingTuner::start(double aTargetAmplitude, double aTargetPeriod, int aCyclesPerTrial, int aMaxTrials)
+{
+  if (aTargetAmplitude<=0 && aTargetPeriod<=0) {
+    return TextError::err("autotune needs a target amplitude and/or period");
+  }
+  targetAmplitude = aTargetAmplitude>0 ? aTargetAmplitude : 0;
+  targetPeriod = aTargetPeriod>0 ? aTargetPeriod : 0;
+  cyclesPerTrial = aCyclesPerTrial>0 ? aCyclesPerTrial : 1;
+  maxTrials = aMaxTrials>0 ? aMaxTrials : 1;
+  for (int p=0; p<numTunedParams; p++) {
+    initialValues[p] = value(p);
+    bestValues[p] = value(p);
+    steps[p] = INITIAL_STEP_RESOLUTIONS*fieldDefs[p]->res;
+  }
+  trials = 0;
+  stepSign = 0; // first trial is the baseline
+  param = 0;
+  lastCost = -1;
+  active = true;
+  LOG(LOG_NOTICE, "Swing autotune started: target amplitude=%.1f degrees, period=%.2f Seconds, %d cycles per trial, max %d trials", targetAmplitude, targetPeriod, cyclesPerTrial, maxTrials);
+  beginTrial();
+  return ErrorPtr();
+}
+
+
+void SwingTuner::abort()
+{
+  if (!active) return;
+  active = false;
+  applyValues(initialValues);
+  LOG(LOG_WARNING, "Swing autotune aborted after %d trials, settings restored", trials);
+}
+
+
+void SwingTuner::beginTrial()
+{
+  halfSwings = 0;
+  accelStart = Never;
+  midpoints = 0;
+  detectedMidpoints = 0;
+  midpointDelaySum = 0;
+  amplitudeSum = 0;
+  amplitudeSamples = 0;
+  lastDetectedMidpoint[0] = Never;
+  lastDetectedMidpoint[1] = Never;
+  periodSum = 0;
+  periodSamples = 0;
+}
+
+
+// MARK: ===== measurements
+
+
+void SwingTuner::accelerating()
+{
+  if (!active) return;
+  accelStart = MainLoop::now();
+}
+
+
+void SwingTuner::midpoint(int aDirection, bool aDetected)
+{
+  if (!active || halfSwings<SETTLE_HALF_SWINGS) return;
+  MLMicroSeconds now = MainLoop::now();
+  midpoints++;
+  if (accelStart!=Never) {
+    midpointDelaySum += (double)(now-accelStart)/Second;
+    accelStart = Never;
+  }
+  if (aDetected) {
+    detectedMidpoints++;
+    int d = aDirection>0 ? 0 : 1;
+    if (lastDetectedMidpoint[d]!=Never) {
+      periodSum += (double)(now-lastDetectedMidpoint[d])/Second;
+      periodSamples++;
+    }
+    lastDetectedMidpoint[d] = now;
+  }
+}
+
+
+bool SwingTuner::reversal(double aAmplitude, bool aAmplitudeValid)
+{
+  if (!active) return false;
+  halfSwings++;
+  if (halfSwings<=SETTLE_HALF_SWINGS) return false;
+  if (aAmplitudeValid) {
+    amplitudeSum += fabs(aAmplitude);
+    amplitudeSamples++;
+  }
+  if (halfSwings<SETTLE_HALF_SWINGS+2*cyclesPerTrial) return false; // trial not yet complete
+  // trial complete
+  double cost = evaluateTrial();
+  if (stepSign==0) {
+    // baseline
+    bestCost = cost;
+    stepSign = 1;
+  }
+  else if (cost<bestCost) {
+    // improvement: keep it, and continue in the same direction
+    bestCost = cost;
+    bestValues[param] = value(param);
+  }
+  else if (stepSign>0) {
+    // no improvement, try other direction
+    stepSign = -1;
+  }
+  else {
+    // no improvement either way: finer steps, next parameter
+    steps[param] /= 2;
+    param = (param+1) % numTunedParams;
+    stepSign = 1;
+  }
+  if (trials<maxTrials && nextCandidate()) {
+    beginTrial();
+    return false;
+  }
+  // done
+  active = false;
+  applyValues(bestValues);
+  LOG(LOG_NOTICE,
+    "Swing autotune complete after %d trials, cost=%.3f: swingMaxPower=%.0f, swingMinPower=%.0f, swingPeriod=%.2f, swingCurveExp=%.2f",
+    trials, bestCost, bestValues[0], bestValues[1], bestValues[2], bestValues[3]
+  );
+  return true;
+}
+
+
+double SwingTuner::evaluateTrial()
+{
+  trials++;
+  double cost = 0;
+  double e;
+  lastAmplitude = amplitudeSamples>0 ? amplitudeSum/amplitudeSamples : 0;
+  lastPeriod = periodSamples>0 ? periodSum/periodSamples : 0;
+  lastDetectedRatio = midpoints>0 ? (double)detectedMidpoints/midpoints : 0;
+  lastMidpointDelay = midpoints>0 ? midpointDelaySum/midpoints : 0;
+  if (targetAmplitude>0) {
+    e = amplitudeSamples>0 ? (lastAmplitude-targetAmplitude)/targetAmplitude : 1;
+    cost += e*e;
+  }
+  if (targetPeriod>0) {
+    e = periodSamples>0 ? (lastPeriod-targetPeriod)/targetPeriod : 1;
+    cost += e*e;
+  }
+  cost += MISSED_MIDPOINT_WEIGHT*(1-lastDetectedRatio);
+  lastCost = cost;
+  LOG(LOG_INFO,
+    "Swing autotune trial %d: amplitude=%.1f, period=%.2f, detected midpoints=%.0f%%, midpoint after %.2f Seconds -> cost=%.3f",
+    trials, lastAmplitude, lastPeriod, lastDetectedRatio*100, lastMidpointDelay, cost
+  );
+  return cost;
+}
+
+
+bool SwingTuner::nextCandidate()
+{
+  for (int moves=0; moves<MAX_SEARCH_MOVES; moves++) {
+    // end search when all steps are below resolution
+    bool anyStep = false;
+    for (int p=0; p<numTunedParams; p++) {
+      if (steps[p]>=fieldDefs[p]->res) { anyStep = true; break; }
+    }
+    if (!anyStep) return false;
+    const SettingsFieldDef &fdef = *fieldDefs[param];
+    double v = bestValues[param];
+    if (steps[param]>=fdef.res) {
+      v += stepSign*steps[param];
+      v = round(v/fdef.res)*fdef.res;
+      if (v<fdef.min) v = fdef.min;
+      if (v>fdef.max) v = fdef.max;
+    }
+    double candidate[numTunedParams];
+    memcpy(candidate, bestValues, sizeof(candidate));
+    candidate[param] = v;
+    if (v!=bestValues[param] && candidate[1]<=candidate[0]) {
+      // valid candidate (changed, and min power not above max power)
+      applyValues(candidate);
+      LOG(LOG_INFO, "Swing autotune: trying %s=%.2f", fdef.fieldName, v);
+      return true;
+    }
+    // not possible in this direction: same as no improvement
+    if (stepSign>0) {
+      stepSign = -1;
+    }
+    else {
+      steps[param] /= 2;
+      param = (param+1) % numTunedParams;
+      stepSign = 1;
+    }
+  }
+  return false;
+}
+
+
+JsonObjectPtr SwingTuner::statusAsJSON()
+{
+  JsonObjectPtr s = JsonObject::newObj();
+  s->add("active", JsonObject::newBool(active));
+  s->add("trials", JsonObject::newInt32(trials));
+  s->add("maxTrials", JsonObject::newInt32(maxTrials));
+  if (trials>0) {
+    s->add("bestCost", JsonObject::newDouble(bestCost));
+    JsonObjectPtr b = JsonObject::newObj();
+    for (int p=0; p<numTunedParams; p++) b->add(fieldDefs[p]->fieldName, JsonObject::newDouble(bestValues[p]));
+    s->add("best", b);
+    JsonObjectPtr l = JsonObject::newObj();
+    l->add("cost", JsonObject::newDouble(lastCost));
+    l->add("amplitude", JsonObject::newDouble(lastAmplitude));
+    l->add("period", JsonObject::newDouble(lastPeriod));
+    l->add("detectedRatio", JsonObject::newDouble(lastDetectedRatio));
+    l->add("midpointDelay", JsonObject::newDouble(lastMidpointDelay));
+    s->add("lastTrial", l);
+  }
+  return s;
+}
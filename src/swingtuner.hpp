@@ -0,0 +1,136 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44wiperd__swingtuner__
+#define __p44wiperd__swingtuner__
+
+#include "p44utils_common.hpp"
+
+#include "wipersettings.hpp"
+#include "jsonobject.hpp"
+
+using namespace std;
+
+namespace p44 {
+
+
+  /// Automatic tuning of the swing parameters (swingMaxPower, swingMinPower, swingPeriod, swingCurveExp).
+  /// Runs trials of some swing cycles each, measuring amplitude (from the position estimate at reversals),
+  /// period (between detected zero position passes in the same direction) and how many midpoints were
+  /// detected rather than simulated. A coordinate search moves one parameter at a time towards lower cost,
+  /// halving the step when neither direction improves.
+  /// The tuner only changes the settings values; the swing state machine picks them up at its next ramp
+  class SwingTuner
+  {
+    enum { numTunedParams = 4 };
+
+    WiperSettings &settings;
+    const SettingsFieldDef *fieldDefs[numTunedParams];
+
+    // targets
+    double targetAmplitude; ///< [degrees], 0 = don't care
+    double targetPeriod; ///< full swing cycle [Seconds], 0 = don't care
+    int cyclesPerTrial;
+    int maxTrials;
+
+    // search state
+    bool active;
+    int trials;
+    double initialValues[numTunedParams];
+    double bestValues[numTunedParams];
+    double steps[numTunedParams];
+    double bestCost;
+    int param; ///< parameter currently varied
+    int stepSign; ///< direction currently tried, 0 = baseline trial
+
+    // measurements of the current trial
+    int halfSwings; ///< reversals since trial start
+    MLMicroSeconds accelStart;
+    long midpoints;
+    long detectedMidpoints;
+    double midpointDelaySum;
+    double amplitudeSum;
+    long amplitudeSamples;
+    MLMicroSeconds lastDetectedMidpoint[2]; ///< by direction (0=CW, 1=CCW)
+    double periodSum;
+    long periodSamples;
+
+    // result of last completed trial
+    double lastCost;
+    double lastAmplitude;
+    double lastPeriod;
+    double lastDetectedRatio;
+    double lastMidpointDelay;
+
+  public:
+
+    SwingTuner(WiperSettings &aSettings);
+
+    /// start tuning, beginning with a baseline trial of the current settings
+    /// @param aTargetAmplitude target swing amplitude from the zero position [degrees], 0 = don't care
+    /// @param aTargetPeriod target full swing cycle time [Seconds], 0 = don't care
+    /// @param aCyclesPerTrial number of full swing cycles measured per trial
+    /// @param aMaxTrials max number of trials (including the baseline)
+    /// @return ok or error if targets are invalid
+    ErrorPtr start(double aTargetAmplitude, double aTargetPeriod, int aCyclesPerTrial, int aMaxTrials);
+
+    /// stop tuning and restore the settings from before start()
+    void abort();
+
+    /// @return true if tuning is in progress
+    bool isActive() { return active; };
+
+    /// @name feedback from the swing state machine
+    /// @{
+
+    /// acceleration towards the midpoint has started
+    void accelerating();
+
+    /// midpoint reached
+    /// @param aDirection current direction 1=CW, -1=CCW
+    /// @param aDetected true if the zero position input was seen, false if the midpoint was simulated
+    void midpoint(int aDirection, bool aDetected);
+
+    /// swing reverses at an endpoint
+    /// @param aAmplitude estimated angle from the zero position [degrees]
+    /// @param aAmplitudeValid true if the position estimate is reliable enough to use aAmplitude
+    /// @return true if tuning is complete now; the best parameters found are then set in the settings
+    bool reversal(double aAmplitude, bool aAmplitudeValid);
+
+    /// @}
+
+    /// @return tuning status and last trial results
+    JsonObjectPtr statusAsJSON();
+
+  private:
+
+    double &value(int aParam);
+    void applyValues(const double *aValues);
+    void beginTrial();
+    double evaluateTrial();
+    bool nextCandidate();
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__swingtuner__) */
@@ -0,0 +1,369 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "weeklyschedule.hpp"
+
+#include <algorithm>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <sys/timerfd.h>
+#ifndef TFD_TIMER_CANCEL_ON_SET
+#define TFD_TIMER_CANCEL_ON_SET (1 << 1) // older libc headers, kernel supports it since 3.0
+#endif
+#endif
+
+using namespace p44;
+
+
+#define MINUTES_PER_DAY (24*60)
+#define MINUTES_PER_WEEK (7*MINUTES_PER_DAY)
+#define MAX_SCHEDULE_WINDOWS 100
+#define FALLBACK_MAX_TIMER (5*Minute) // without timerfd, clock changes are only noticed this late
+
+
+WeeklySchedule::WeeklySchedule(ParamStore &aParamStore, int aMaxMode) :
+  paramStore(aParamStore),
+  maxMode(aMaxMode),
+  currentMode(-1),
+  timerFd(-1),
+  timerTicket(0)
+{
+}
+
+
+WeeklySchedule::~WeeklySchedule()
+{
+  MainLoop::currentMainLoop().cancelExecutionTicket(timerTicket);
+  if (timerFd>=0) {
+    MainLoop::currentMainLoop().unregisterPollHandler(timerFd);
+    close(timerFd);
+  }
+}
+
+
+// MARK: ===== schedule evaluation
+
+
+int WeeklySchedule::weekMinute(time_t aTime)
+{
+  struct tm t;
+  localtime_r(&aTime, &t);
+  return t.tm_wday*MINUTES_PER_DAY + t.tm_hour*60 + t.tm_min;
+}
+
+
+bool WeeklySchedule::weekMinuteBefore(int aWeekMinute, const Transition &aTransition)
+{
+  return aWeekMinute<aTransition.weekMinute;
+}
+
+
+void WeeklySchedule::compile()
+{
+  transitions.clear();
+  if (windows.empty()) return;
+  // all window boundaries are potential transitions
+  std::vector<int> bounds;
+  for (WindowVector::iterator w = windows.begin(); w!=windows.end(); ++w) {
+    for (int d=0; d<7; d++) {
+      if (w->days & (1<<d)) {
+        bounds.push_back(d*MINUTES_PER_DAY+w->from);
+        bounds.push_back((d*MINUTES_PER_DAY+w->to+(w->to<=w->from ? MINUTES_PER_DAY : 0)) % MINUTES_PER_WEEK);
+      }
+    }
+  }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+  // evaluate mode at each boundary, keep only actual changes
+  for (std::vector<int>::iterator b = bounds.begin(); b!=bounds.end(); ++b) {
+    int mode = 0;
+    for (WindowVector::iterator w = windows.begin(); w!=windows.end(); ++w) {
+      int len = w->to>w->from ? w->to-w->from : w->to-w->from+MINUTES_PER_DAY;
+      for (int d=0; d<7; d++) {
+        if ((w->days & (1<<d)) && ((*b-d*MINUTES_PER_DAY-w->from+MINUTES_PER_WEEK) % MINUTES_PER_WEEK)<len) {
+          if (w->mode>mode) mode = w->mode;
+        }
+      }
+    }
+    if (transitions.empty() || transitions.back().mode!=mode) {
+      Transition t;
+      t.weekMinute = *b;
+      t.mode = mode;
+      transitions.push_back(t);
+    }
+  }
+  // first transition is no change when the week wraps around with the same mode
+  if (transitions.size()>1 && transitions.front().mode==transitions.back().mode) {
+    transitions.erase(transitions.begin());
+  }
+  // a schedule without any windows active is "mode 0 all the time"
+  if (transitions.empty()) {
+    Transition t;
+    t.weekMinute = 0;
+    t.mode = 0;
+    transitions.push_back(t);
+  }
+  LOG(LOG_INFO, "Schedule: %d windows, %d transitions per week", (int)windows.size(), (int)transitions.size());
+}
+
+
+int WeeklySchedule::modeAt(time_t aTime)
+{
+  if (transitions.empty()) return -1;
+  TransitionVector::iterator pos = std::upper_bound(transitions.begin(), transitions.end(), weekMinute(aTime), weekMinuteBefore);
+  // last transition at or before now, wrapping around to end of the previous week
+  if (pos==transitions.begin()) pos = transitions.end();
+  return (pos-1)->mode;
+}
+
+
+time_t WeeklySchedule::nextTransitionAfter(time_t aTime)
+{
+  if (transitions.empty()) return 0;
+  struct tm t;
+  localtime_r(&aTime, &t);
+  int wm = t.tm_wday*MINUTES_PER_DAY + t.tm_hour*60 + t.tm_min;
+  TransitionVector::iterator pos = std::upper_bound(transitions.begin(), transitions.end(), wm, weekMinuteBefore);
+  int next = pos==transitions.end() ? transitions.front().weekMinute+MINUTES_PER_WEEK : pos->weekMinute;
+  // let mktime do the calendar and DST math
+  t.tm_sec = 0;
+  t.tm_min += next-wm;
+  t.tm_isdst = -1;
+  return mktime(&t);
+}
+
+
+
+// MARK: ===== timer
+
+
+int WeeklySchedule::start(ScheduleModeCB aModeCB)
+{
+  modeCB = aModeCB;
+  #ifdef __linux__
+  if (timerFd<0) {
+    // wall clock timer that also fires when the clock is set
+    timerFd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (timerFd>=0) {
+      MainLoop::currentMainLoop().registerPollHandler(timerFd, POLLIN, boost::bind(&WeeklySchedule::timerFdHandler, this, _1, _2));
+    }
+    else {
+      LOG(LOG_WARNING, "Schedule: no timerfd, falling back to mainloop timer");
+    }
+  }
+  #endif
+  currentMode = modeAt(time(NULL));
+  arm();
+  return currentMode;
+}
+
+
+void WeeklySchedule::arm()
+{
+  MainLoop::currentMainLoop().cancelExecutionTicket(timerTicket);
+  time_t now = time(NULL);
+  time_t next = modeCB ? nextTransitionAfter(now) : 0;
+  #ifdef __linux__
+  if (timerFd>=0) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = next; // 0 disarms
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME|TFD_TIMER_CANCEL_ON_SET, &its, NULL)==0) {
+      if (next) LOG(LOG_INFO, "Schedule: next transition in %ld seconds", (long)(next-now));
+      return;
+    }
+    LOG(LOG_WARNING, "Schedule: cannot arm timerfd: %s", strerror(errno));
+  }
+  #endif
+  if (next==0) return;
+  MLMicroSeconds delay = (MLMicroSeconds)(next-now)*Second;
+  if (delay>FALLBACK_MAX_TIMER) delay = FALLBACK_MAX_TIMER;
+  MainLoop::currentMainLoop().executeTicketOnce(timerTicket, boost::bind(&WeeklySchedule::check, this), delay);
+}
+
+
+bool WeeklySchedule::timerFdHandler(int aFD, int aPollFlags)
+{
+  uint64_t expirations;
+  if (read(aFD, &expirations, sizeof(expirations))<0 && errno==ECANCELED) {
+    LOG(LOG_NOTICE, "Schedule: wall clock was changed, re-evaluating");
+  }
+  check();
+  return true;
+}
+
+
+void WeeklySchedule::check()
+{
+  int mode = modeAt(time(NULL));
+  if (mode!=currentMode) {
+    currentMode = mode;
+    if (mode>=0 && modeCB) {
+      LOG(LOG_NOTICE, "Schedule: mode changes to %d", mode);
+      modeCB(mode);
+    }
+  }
+  arm();
+}
+
+
+
+// MARK: ===== persistence
+
+
+ErrorPtr WeeklySchedule::load()
+{
+  windows.clear();
+  sqlite3pp::query qry(paramStore);
+  if (qry.prepare("SELECT days, fromMinute, toMinute, mode FROM ScheduleWindows ORDER BY ROWID")!=SQLITE_OK) {
+    return TextError::err("cannot read schedule: %s", paramStore.error_msg());
+  }
+  for (sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i) {
+    Window w;
+    w.days = i->get<int>(0);
+    w.from = i->get<int>(1);
+    w.to = i->get<int>(2);
+    w.mode = i->get<int>(3);
+    windows.push_back(w);
+  }
+  compile();
+  return ErrorPtr();
+}
+
+
+ErrorPtr WeeklySchedule::save()
+{
+  if (paramStore.execute("BEGIN")!=SQLITE_OK || paramStore.execute("DELETE FROM ScheduleWindows")!=SQLITE_OK) {
+    return TextError::err("cannot save schedule: %s", paramStore.error_msg());
+  }
+  for (WindowVector::iterator w = windows.begin(); w!=windows.end(); ++w) {
+    sqlite3pp::command cmd(paramStore);
+    if (
+      cmd.prepare("INSERT INTO ScheduleWindows (days, fromMinute, toMinute, mode) VALUES (?, ?, ?, ?)")!=SQLITE_OK ||
+      cmd.bind(1, w->days)!=SQLITE_OK ||
+      cmd.bind(2, w->from)!=SQLITE_OK ||
+      cmd.bind(3, w->to)!=SQLITE_OK ||
+      cmd.bind(4, w->mode)!=SQLITE_OK ||
+      cmd.execute()!=SQLITE_OK
+    ) {
+      ErrorPtr err = TextError::err("cannot save schedule: %s", paramStore.error_msg());
+      paramStore.execute("ROLLBACK");
+      return err;
+    }
+  }
+  paramStore.execute("COMMIT");
+  return ErrorPtr();
+}
+
+
+
+// MARK: ===== API
+
+
+static bool parseTimeOfDay(JsonObjectPtr aTime, int &aMinute)
+{
+  int h, m;
+  if (!aTime || sscanf(aTime->c_strValue(), "%d:%d", &h, &m)!=2) return false;
+  if (h==24 && m==0) h = 0; // end of day
+  if (h<0 || h>23 || m<0 || m>59) return false;
+  aMinute = h*60+m;
+  return true;
+}
+
+
+ErrorPtr WeeklySchedule::windowsFromJSON(JsonObjectPtr aWindows, WindowVector &aNewWindows)
+{
+  if (!aWindows->isType(json_type_array)) return TextError::err("'windows' must be an array");
+  if (aWindows->arrayLength()>MAX_SCHEDULE_WINDOWS) return TextError::err("too many windows (max %d)", MAX_SCHEDULE_WINDOWS);
+  for (int i=0; i<aWindows->arrayLength(); i++) {
+    JsonObjectPtr wo = aWindows->arrayGet(i);
+    JsonObjectPtr o;
+    Window w;
+    if (!wo || !wo->isType(json_type_object)) return TextError::err("window %d: must be a JSON object", i);
+    if (!parseTimeOfDay(wo->get("from"), w.from)) return TextError::err("window %d: 'from' must be \"HH:MM\"", i);
+    if (!parseTimeOfDay(wo->get("to"), w.to)) return TextError::err("window %d: 'to' must be \"HH:MM\"", i);
+    if (!wo->get("mode", o)) return TextError::err("window %d: missing 'mode'", i);
+    w.mode = o->int32Value();
+    if (w.mode<0 || w.mode>maxMode) return TextError::err("window %d: 'mode' must be within 0..%d", i, maxMode);
+    w.days = 0x7F; // default: every day
+    if (wo->get("days", o)) {
+      if (!o->isType(json_type_array)) return TextError::err("window %d: 'days' must be an array of 0(=Sunday)..6", i);
+      w.days = 0;
+      for (int j=0; j<o->arrayLength(); j++) {
+        int d = o->arrayGet(j)->int32Value();
+        if (d<0 || d>6) return TextError::err("window %d: day %d out of range 0(=Sunday)..6", i, d);
+        w.days |= 1<<d;
+      }
+    }
+    aNewWindows.push_back(w);
+  }
+  return ErrorPtr();
+}
+
+
+ErrorPtr WeeklySchedule::processRequest(JsonObjectPtr aData, bool aIsAction, JsonObjectPtr &aResult)
+{
+  JsonObjectPtr o;
+  if (aIsAction && aData && aData->get("windows", o)) {
+    // replace schedule
+    WindowVector newWindows;
+    ErrorPtr err = windowsFromJSON(o, newWindows);
+    if (!Error::isOK(err)) return err;
+    windows = newWindows;
+    compile();
+    err = save();
+    // apply now
+    check();
+    return err;
+  }
+  // return schedule and state
+  aResult = JsonObject::newObj();
+  JsonObjectPtr wl = JsonObject::newArray();
+  for (WindowVector::iterator w = windows.begin(); w!=windows.end(); ++w) {
+    JsonObjectPtr wo = JsonObject::newObj();
+    JsonObjectPtr dl = JsonObject::newArray();
+    for (int d=0; d<7; d++) {
+      if (w->days & (1<<d)) dl->arrayAppend(JsonObject::newInt32(d));
+    }
+    wo->add("days", dl);
+    wo->add("from", JsonObject::newString(string_format("%02d:%02d", w->from/60, w->from%60)));
+    wo->add("to", JsonObject::newString(string_format("%02d:%02d", w->to/60, w->to%60)));
+    wo->add("mode", JsonObject::newInt32(w->mode));
+    wl->arrayAppend(wo);
+  }
+  aResult->add("windows", wl);
+  aResult->add("active", JsonObject::newBool(isActive()));
+  if (isActive()) {
+    time_t now = time(NULL);
+    aResult->add("mode", JsonObject::newInt32(modeAt(now)));
+    time_t next = nextTransitionAfter(now);
+    struct tm t;
+    localtime_r(&next, &t);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", &t);
+    aResult->add("nextTransition", JsonObject::newString(buf));
+    aResult->add("nextMode", JsonObject::newInt32(modeAt(next)));
+  }
+  return ErrorPtr();
+}
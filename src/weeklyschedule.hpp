@@ -0,0 +1,120 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44wiperd__weeklyschedule__
+#define __p44wiperd__weeklyschedule__
+
+#include "p44utils_common.hpp"
+
+#include "persistentparams.hpp"
+#include "jsonobject.hpp"
+
+#include <time.h>
+
+using namespace std;
+
+namespace p44 {
+
+
+  /// called when the scheduled mode changes
+  /// @param aMode the new mode
+  typedef boost::function<void (int aMode)> ScheduleModeCB;
+
+
+  /// weekly schedule of operating mode windows, in local time.
+  /// Outside all windows, the scheduled mode is 0. Where windows overlap, the highest mode wins.
+  /// The schedule is compiled into a sorted list of transitions, so finding the current mode and the next
+  /// transition is a binary search, and only one timer (for the next transition) is armed at any time.
+  class WeeklySchedule
+  {
+    typedef struct {
+      int days; ///< bitmask of days, bit 0 = Sunday .. bit 6 = Saturday
+      int from; ///< start of window, minute of day
+      int to; ///< end of window, minute of day (to<=from means window extends past midnight)
+      int mode; ///< mode within window
+    } Window;
+    typedef std::vector<Window> WindowVector;
+
+    typedef struct {
+      int weekMinute; ///< minute of week (0 = Sunday 00:00) where mode changes
+      int mode; ///< mode from weekMinute up to next transition
+    } Transition;
+    typedef std::vector<Transition> TransitionVector;
+
+    ParamStore &paramStore;
+    int maxMode;
+    WindowVector windows;
+    TransitionVector transitions; ///< sorted by weekMinute
+    ScheduleModeCB modeCB;
+    int currentMode; ///< mode last reported, -1 if not started or schedule inactive
+    int timerFd; ///< timerfd on CLOCK_REALTIME (cancelled by clock changes), -1 if not available
+    long timerTicket; ///< fallback mainloop timer
+
+  public:
+
+    /// @param aParamStore the database to store the schedule in
+    /// @param aMaxMode highest mode number allowed in windows
+    WeeklySchedule(ParamStore &aParamStore, int aMaxMode);
+    ~WeeklySchedule();
+
+    /// load schedule from the database
+    ErrorPtr load();
+
+    /// @return true if the schedule has any windows, i.e. controls the mode
+    bool isActive() { return !windows.empty(); };
+
+    /// start following the schedule
+    /// @param aModeCB called whenever the scheduled mode changes (at transitions, or because of clock changes)
+    /// @return the current scheduled mode, or -1 if the schedule is not active
+    int start(ScheduleModeCB aModeCB);
+
+    /// @param aTime a (wall clock) time
+    /// @return scheduled mode at aTime, -1 if schedule is not active
+    int modeAt(time_t aTime);
+
+    /// @param aTime a (wall clock) time
+    /// @return time of the first transition after aTime, 0 if schedule is not active
+    time_t nextTransitionAfter(time_t aTime);
+
+    /// process a "schedule" API request
+    /// @param aData the request data (can be NULL for plain reads)
+    /// @param aIsAction true if request is an action (write)
+    /// @param aResult will be set to the result object, if any
+    /// @return ok or error
+    ErrorPtr processRequest(JsonObjectPtr aData, bool aIsAction, JsonObjectPtr &aResult);
+
+  private:
+
+    ErrorPtr windowsFromJSON(JsonObjectPtr aWindows, WindowVector &aNewWindows);
+    ErrorPtr save();
+    void compile();
+    void arm();
+    void check();
+    bool timerFdHandler(int aFD, int aPollFlags);
+    static int weekMinute(time_t aTime);
+    static bool weekMinuteBefore(int aWeekMinute, const Transition &aTransition);
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__weeklyschedule__) */
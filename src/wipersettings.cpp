@@ -0,0 +1,810 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "wipersettings.hpp"
+
+using namespace p44;
+
+
+// MARK: ===== settings definitions
+
+#define OFFS(fld) offsetof(WiperSettings, fld)
+
+const SettingsFieldDef p44::settingsFieldDefs[] = {
+  {
+    .fieldName = "initialMode",
+    .title =  "Initial mode after startup: 0=off, 1=auto, 2=on",
+    .jsonType = json_type_int,
+    .offset = OFFS(initialMode),
+    .min = 0,
+    .max = 2,
+    .res = 1,
+    .def = 0 // off
+  },
+  {
+    .fieldName = "wiperType",
+    .title =  "Type of wiper motor: 0=mechanical wiper, 1=just motor with software controlled wiping",
+    .jsonType = json_type_int,
+    .offset = OFFS(wiperType),
+    .min = 0,
+    .max = 1,
+    .res = 1,
+    .def = wiper_software // new wiper with software wiping
+  },
+  {
+    .fieldName = "calibratePower",
+    .title =  "Motor power for calibration runs [%]",
+    .jsonType = json_type_double,
+    .offset = OFFS(calibratePower),
+    .min = 20,
+    .max = 100,
+    .res = 1,
+    .def = 80 // moderate
+  },
+  {
+    .fieldName = "calibrateRotationTime",
+    .title =  "Time for one full rotation [seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(calibrateRotationTime),
+    .min = 1,
+    .max = 10,
+    .res = 0.05,
+    .def = 3 // measured @ 80% power
+  },
+  {
+    .fieldName = "rezeroSwingAngle",
+    .title =  "Max angle to move left or right for rezeroing [degrees]",
+    .jsonType = json_type_double,
+    .offset = OFFS(rezeroSwingAngle),
+    .min = 30,
+    .max = 200,
+    .res = 1,
+    .def = 90 // half circle max
+  },
+  {
+    .fieldName = "findZeroRamp",
+    .title =  "Full power ramp time during zero position find [seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(findZeroRamp),
+    .min = 0,
+    .max = 1,
+    .res = 0.05,
+    .def = 0.1 // not too sudden start+stop
+  },
+  {
+    .fieldName = "swingMaxPower",
+    .title =  "Swing max power [%] (also for mechanical wiper type)",
+    .jsonType = json_type_double,
+    .offset = OFFS(swingMaxPower),
+    .min = 0,
+    .max = 100,
+    .res = 1,
+    .def = 80 // moderate
+  },
+  {
+    .fieldName = "swingMinPower",
+    .title =  "Swing min power [%]",
+    .jsonType = json_type_double,
+    .offset = OFFS(swingMinPower),
+    .min = 0,
+    .max = 100,
+    .res = 1,
+    .def = 70 // almost off
+  },
+  {
+    .fieldName = "swingPeriod",
+    .title =  "Swing period [seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(swingPeriod),
+    .min = 0,
+    .max = 2,
+    .res = 0.02,
+    .def = 0.3 // one swing time
+  },
+  {
+    .fieldName = "swingCurveExp",
+    .title =  "Swing power curve exponent, -1.85 is near sine wave",
+    .jsonType = json_type_double,
+    .offset = OFFS(swingCurveExp),
+    .min = -5,
+    .max = 5,
+    .res = 0.05,
+    .def = -1.85 // near sine
+  },
+  {
+    .fieldName = "midPointAdjustTime",
+    .title =  "Midpoint adjust ramp time [Seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(midPointAdjustTime),
+    .min = 0,
+    .max = 1,
+    .res = 0.02,
+    .def = 0.1 // quick
+  },
+  {
+    .fieldName = "midPointSearchTime",
+    .title =  "Max time waiting for midpoint after swingdown ramp, 0=forever [Seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(midPointSearchTime),
+    .min = 0,
+    .max = 10,
+    .res = 0.1,
+    .def = 1 // not too long
+  },
+  {
+    .fieldName = "dirChangeTime",
+    .title =  "Time for changing direction [Seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(dirChangeTime),
+    .min = 0,
+    .max = 5,
+    .res = 0.05,
+    .def = 0.2 // not too long
+  },
+  {
+    .fieldName = "runTimeAfterMovement",
+    .title =  "How long wiper runs after detecting movement [Seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(runTimeAfterMovement),
+    .min = 5,
+    .max = 300,
+    .res = 1,
+    .def = 15 // a bit
+  },
+  {
+    .fieldName = "maxRunTime",
+    .title =  "How long wiper will run totally (including retriggers) [Seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(maxRunTime),
+    .min = 5,
+    .max = 3600,
+    .res = 5,
+    .def = 30 // a bit more
+  },
+  {
+    .fieldName = "pauseTime",
+    .title =  "How long wiper will pause after completed movement [Seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(pauseTime),
+    .min = 5,
+    .max = 1800,
+    .res = 5,
+    .def = 10 // a bit
+  },
+  {
+    .fieldName = "haltTime",
+    .title =  "Full ramp time when halting wiper (or starting mechanical wiper) [Seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(haltTime),
+    .min = 0,
+    .max = 4,
+    .res = 0.05,
+    .def = 0.4 // a bit
+  },
+  {
+    .fieldName = "swingCurveType",
+    .title =  "Swing ramp profile: 0=exponential (swingCurveExp), 1=S-curve (smooth reversals, swingCurveExp shifts inflection), 2=sine waveform, 3=user waveform (--waveform)",
+    .jsonType = json_type_int,
+    .offset = OFFS(swingCurveType),
+    .min = 0,
+    .max = 3,
+    .res = 1,
+    .def = 0 // exponential, as before
+  },
+  {
+    .fieldName = "reversalBrakePower",
+    .title =  "Active braking power at direction reversals, needs separate CW/CCW outputs (0=no braking) [%]",
+    .jsonType = json_type_double,
+    .offset = OFFS(reversalBrakePower),
+    .min = 0,
+    .max = 100,
+    .res = 1,
+    .def = 0 // no braking, as before
+  },
+  {
+    .fieldName = "reversalBrakeTime",
+    .title =  "Active braking time at direction reversals, part of dirChangeTime [Seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(reversalBrakeTime),
+    .min = 0,
+    .max = 1,
+    .res = 0.01,
+    .def = 0.05 // short
+  },
+  {
+    .fieldName = "watchdogLimit",
+    .title =  "Mainloop stall time after which the watchdog stops the motor (0=never) [Seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(watchdogLimit),
+    .min = 0,
+    .max = 10,
+    .res = 0.1,
+    .def = 1 // much more than a ramp step
+  },
+  {
+    .fieldName = "preArmTime",
+    .title =  "Auto mode: pre-arm (hold idle power) this long before the pause ends, and until as long after it (0=never) [Seconds]",
+    .jsonType = json_type_double,
+    .offset = OFFS(preArmTime),
+    .min = 0,
+    .max = 60,
+    .res = 0.5,
+    .def = 0 // no pre-arming, as before
+  },
+  {
+    .fieldName = "preArmPower",
+    .title =  "Auto mode: idle power held towards the next swing while pre-armed [%]",
+    .jsonType = json_type_double,
+    .offset = OFFS(preArmPower),
+    .min = 0,
+    .max = 100,
+    .res = 1,
+    .def = 20 // should not yet move the arm noticeably
+  },
+  {
+    .fieldName = "positionMaxPower",
+    .title =  "Positioning: max power when driving to a target angle [%]",
+    .jsonType = json_type_double,
+    .offset = OFFS(positionMaxPower),
+    .min = 0,
+    .max = 100,
+    .res = 1,
+    .def = 40
+  },
+  {
+    .fieldName = "positionMinPower",
+    .title =  "Positioning: min power to move the arm at all [%]",
+    .jsonType = json_type_double,
+    .offset = OFFS(positionMinPower),
+    .min = 0,
+    .max = 100,
+    .res = 1,
+    .def = 15
+  },
+  {
+    .fieldName = "positionGain",
+    .title =  "Positioning: power per degree of angle error [%/degree]",
+    .jsonType = json_type_double,
+    .offset = OFFS(positionGain),
+    .min = 0,
+    .max = 20,
+    .res = 0.1,
+    .def = 2
+  },
+  {
+    .fieldName = "positionDamping",
+    .title =  "Positioning: power reduction per degree/second of speed [%/(degree/Second)]",
+    .jsonType = json_type_double,
+    .offset = OFFS(positionDamping),
+    .min = 0,
+    .max = 2,
+    .res = 0.01,
+    .def = 0.05
+  },
+  {
+    .fieldName = "positionTolerance",
+    .title =  "Positioning: angle error within which the target counts as reached [degrees]",
+    .jsonType = json_type_double,
+    .offset = OFFS(positionTolerance),
+    .min = 0.5,
+    .max = 45,
+    .res = 0.5,
+    .def = 3
+  },
+};
+
+const int p44::numSettingsFields = sizeof(settingsFieldDefs)/sizeof(SettingsFieldDef);
+
+
+
+// MARK: ===== settings DB database
+
+
+string WiperParamStore::dbSchemaUpgradeSQL(int aFromVersion, int &aToVersion)
+{
+  string sql;
+  if (aFromVersion==0) {
+    // create DB from scratch
+    // - use standard globs table for schema version
+    sql = inherited::dbSchemaUpgradeSQL(aFromVersion, aToVersion);
+    // - no vdchost level table to create at this time
+    //   (PersistentParams create and update their tables as needed)
+    // reached version 1
+    aToVersion = 1;
+  }
+  else if (aFromVersion==1) {
+    // version 2 adds motion patterns
+    sql =
+      "CREATE TABLE MotionPatterns ("
+      " name TEXT NOT NULL PRIMARY KEY,"
+      " definition TEXT,"
+      " selected INTEGER"
+      ");";
+    aToVersion = 2;
+  }
+  else if (aFromVersion==2) {
+    // version 3 adds the operating schedule
+    sql =
+      "CREATE TABLE ScheduleWindows ("
+      " days INTEGER,"
+      " fromMinute INTEGER,"
+      " toMinute INTEGER,"
+      " mode INTEGER"
+      ");";
+    aToVersion = 3;
+  }
+  return sql;
+}
+
+
+
+// MARK: ===== persistent settings
+
+#define FLD(ty,offs) (*((ty*)(((char *)static_cast<WiperSettings *>(this))+offs)))
+
+
+WiperSettingsParams::WiperSettingsParams(ParamStore &aParamStore) :
+  inheritedParams(aParamStore)
+{
+  default_settings();
+}
+
+
+void WiperSettingsParams::default_settings()
+{
+  for (int i=0; i<numSettingsFields; i++) {
+    const SettingsFieldDef &fdef = settingsFieldDefs[i];
+    switch (fdef.jsonType) {
+      case json_type_boolean: FLD(bool, fdef.offset) = fdef.def>0; break;
+      case json_type_double: FLD(double, fdef.offset) = fdef.def; break;
+      case json_type_int: FLD(int, fdef.offset) = fdef.def; break;
+      default: break; // cannot initialize other types
+    }
+  }
+}
+
+
+void WiperSettingsParams::logParams()
+{
+  for (int i=0; i<numSettingsFields; i++) {
+    const SettingsFieldDef &fdef = settingsFieldDefs[i];
+    string s;
+    switch (fdef.jsonType) {
+      case json_type_boolean: s = string_format("%s", FLD(bool, fdef.offset) ? "true" : "false"); break;
+      case json_type_double: s = string_format("%.3f", FLD(double, fdef.offset)); break;
+      case json_type_int: s = string_format("%d", FLD(int, fdef.offset)); break;
+      case json_type_string: s = string_format("'%s'", FLD(string, fdef.offset).c_str()); break;
+      default: s = "<unknown>"; break;
+    }
+    LOG(LOG_INFO, "%s = %s  (%s)", fdef.fieldName, s.c_str(), fdef.title);
+  }
+}
+
+
+JsonObjectPtr WiperSettingsParams::fieldAsJSON(const SettingsFieldDef &aFdef)
+{
+  JsonObjectPtr val;
+  switch (aFdef.jsonType) {
+    case json_type_boolean: val = JsonObject::newBool(FLD(bool, aFdef.offset)); break;
+    case json_type_double: val = JsonObject::newDouble(FLD(double, aFdef.offset)); break;
+    case json_type_int: val = JsonObject::newInt64(FLD(int, aFdef.offset)); break;
+    case json_type_string: val = val = JsonObject::newString(FLD(string, aFdef.offset)); break;
+    default: val = JsonObject::newNull(); break;
+  }
+  return val;
+}
+
+
+void WiperSettingsParams::JSONtoField(const SettingsFieldDef &aFdef, JsonObjectPtr aValue)
+{
+  switch (aFdef.jsonType) {
+    case json_type_boolean: FLD(bool, aFdef.offset) = aValue->boolValue(); break;
+    case json_type_double: {
+      double v = aValue->doubleValue();
+      if (v>aFdef.max) v = aFdef.max;
+      else if (v<aFdef.min) v = aFdef.min;
+      FLD(double, aFdef.offset) = v;
+      break;
+    }
+    case json_type_int: {
+      int v = aValue->int32Value();
+      if (v>aFdef.max) v = aFdef.max;
+      else if (v<aFdef.min) v = aFdef.min;
+      FLD(int, aFdef.offset) = v;
+      break;
+    }
+    case json_type_string: FLD(string, aFdef.offset) = aValue->stringValue(); break;
+    default: break;
+  }
+}
+
+
+ErrorPtr WiperSettingsParams::processRequest(JsonObjectPtr aData, bool aIsAction, JsonObjectPtr &aResult)
+{
+  JsonObjectPtr o;
+  string fieldName;
+  if (aIsAction && aData && aData->get("action", o)) {
+    // settings actions
+    string a = o->stringValue();
+    if (a=="save") {
+      save();
+    }
+    else if (a=="reload") {
+      load();
+      markDirty(); // potentially changed
+    }
+    else if (a=="defaults") {
+      default_settings();
+      markDirty(); // potentially changed
+    }
+  }
+  else if (aData && aData->get("field", o)) {
+    fieldName = o->stringValue();
+    // single field access
+    for (int i=0; i<numSettingsFields; i++) {
+      const SettingsFieldDef &fdef = settingsFieldDefs[i];
+      if (fieldName==fdef.fieldName) {
+        if (aData->get("value", o)) {
+          // write
+          JSONtoField(fdef, o);
+          markDirty();
+        }
+        else {
+          // read
+          aResult = fieldAsJSON(fdef);
+        }
+        break;
+      }
+    }
+  }
+  else {
+    // return all fields
+    aResult = JsonObject::newObj();
+    for (int i=0; i<numSettingsFields; i++) {
+      const SettingsFieldDef &fdef = settingsFieldDefs[i];
+      JsonObjectPtr fld = JsonObject::newObj();
+      fld->add("title", JsonObject::newString(fdef.title));
+      if (fdef.jsonType==json_type_double) {
+        fld->add("min", JsonObject::newDouble(fdef.min));
+        fld->add("max", JsonObject::newDouble(fdef.max));
+        if (fdef.res!=0) fld->add("res", JsonObject::newDouble(fdef.res));
+        fld->add("def", JsonObject::newDouble(fdef.def));
+      }
+      else if (fdef.jsonType==json_type_int) {
+        fld->add("min", JsonObject::newInt64(fdef.min));
+        fld->add("max", JsonObject::newInt64(fdef.max));
+        if (fdef.res!=0) fld->add("res", JsonObject::newInt64(fdef.res));
+        fld->add("def", JsonObject::newInt64(fdef.def));
+      }
+      fld->add("value", fieldAsJSON(fdef));
+      aResult->add(fdef.fieldName, fld);
+    }
+  }
+  return ErrorPtr();
+}
+
+
+
+ErrorPtr WiperSettingsParams::applyJSON(JsonObjectPtr aSettings, int &aNumChanged)
+{
+  aNumChanged = 0;
+  if (!aSettings || !aSettings->isType(json_type_object)) {
+    return TextError::err("settings must be a JSON object");
+  }
+  // validate all before applying any
+  std::vector<const SettingsFieldDef *> fdefs;
+  std::vector<JsonObjectPtr> values;
+  aSettings->resetKeyIteration();
+  string key;
+  JsonObjectPtr o;
+  while (aSettings->nextKeyValue(key, o)) {
+    const SettingsFieldDef *fdef = NULL;
+    for (int i=0; i<numSettingsFields; i++) {
+      if (key==settingsFieldDefs[i].fieldName) {
+        fdef = &settingsFieldDefs[i];
+        break;
+      }
+    }
+    if (!fdef) return TextError::err("unknown setting '%s'", key.c_str());
+    if (!o) return TextError::err("setting '%s' must not be null", key.c_str());
+    switch (fdef->jsonType) {
+      case json_type_double:
+      case json_type_int: {
+        if (!o->isType(json_type_double) && !o->isType(json_type_int)) {
+          return TextError::err("setting '%s' must be a number", key.c_str());
+        }
+        double v = o->doubleValue();
+        if (fdef->jsonType==json_type_int && v!=o->int32Value()) {
+          return TextError::err("setting '%s' must be an integer", key.c_str());
+        }
+        if (v<fdef->min || v>fdef->max) {
+          return TextError::err("setting '%s' = %g is out of range %g..%g", key.c_str(), v, fdef->min, fdef->max);
+        }
+        break;
+      }
+      default:
+        if (!o->isType(fdef->jsonType)) {
+          return TextError::err("setting '%s' has wrong type", key.c_str());
+        }
+        break;
+    }
+    fdefs.push_back(fdef);
+    values.push_back(o);
+  }
+  // apply the fields that differ
+  for (size_t i=0; i<fdefs.size(); i++) {
+    const SettingsFieldDef &fdef = *fdefs[i];
+    bool changed;
+    switch (fdef.jsonType) {
+      case json_type_boolean: changed = FLD(bool, fdef.offset)!=values[i]->boolValue(); break;
+      case json_type_double: changed = FLD(double, fdef.offset)!=values[i]->doubleValue(); break;
+      case json_type_int: changed = FLD(int, fdef.offset)!=values[i]->int32Value(); break;
+      case json_type_string: changed = FLD(string, fdef.offset)!=values[i]->stringValue(); break;
+      default: changed = false; break;
+    }
+    if (changed) {
+      LOG(LOG_NOTICE, "Setting %s changed to %s", fdef.fieldName, values[i]->c_strValue());
+      JSONtoField(fdef, values[i]);
+      aNumChanged++;
+    }
+  }
+  if (aNumChanged>0) saveChanges();
+  return ErrorPtr();
+}
+
+
+ErrorPtr WiperSettingsParams::applyFile(const string &aFilePath, int &aNumChanged)
+{
+  aNumChanged = 0;
+  FILE *f = fopen(aFilePath.c_str(), "r");
+  if (!f) return SysError::errNo("cannot open settings file: ");
+  string text;
+  string_fgetfile(f, text);
+  fclose(f);
+  JsonObjectPtr s = JsonObject::objFromText(text.c_str());
+  if (!s) return TextError::err("settings file '%s' is not valid JSON", aFilePath.c_str());
+  return applyJSON(s, aNumChanged);
+}
+
+
+
+// MARK: ===== persistence implementation
+
+
+ErrorPtr WiperSettingsParams::load()
+{
+  return loadFromStore(NULL);
+}
+
+
+void WiperSettingsParams::saveChanges()
+{
+  markDirty();
+  save();
+}
+
+
+void WiperSettingsParams::save()
+{
+  MLMicroSeconds start = MainLoop::now();
+  ErrorPtr err = saveToStore(NULL, false);
+  saveTimes.add(MainLoop::now()-start);
+  if (!Error::isOK(err)) {
+    LOG(LOG_ERR, "cannot save params: %s", err->description().c_str());
+  }
+}
+
+
+
+// SQLIte3 table name to store these parameters to
+const char *WiperSettingsParams::tableName()
+{
+  return "WiperSettings";
+}
+
+
+// data field definitions
+
+size_t WiperSettingsParams::numFieldDefs()
+{
+  return inheritedParams::numFieldDefs()+numSettingsFields;
+}
+
+
+const FieldDefinition *WiperSettingsParams::getFieldDef(size_t aIndex)
+{
+  static FieldDefinition fdef; // Warning: not thread safe
+
+  if (aIndex<inheritedParams::numFieldDefs())
+    return inheritedParams::getFieldDef(aIndex);
+  aIndex -= inheritedParams::numFieldDefs();
+  if (aIndex<numSettingsFields) {
+    fdef.fieldName = settingsFieldDefs[aIndex].fieldName;
+    switch (settingsFieldDefs[aIndex].jsonType) {
+      case json_type_boolean: fdef.dataTypeCode = SQLITE_INTEGER; break;
+      case json_type_double: fdef.dataTypeCode = SQLITE_FLOAT; break;
+      case json_type_int: fdef.dataTypeCode = SQLITE_INTEGER; break;
+      case json_type_string: fdef.dataTypeCode = SQLITE_TEXT; break;
+      default: fdef.dataTypeCode = SQLITE_TEXT; break;
+    }
+    return &fdef;
+  }
+  return NULL;
+}
+
+
+/// load values from passed row
+void WiperSettingsParams::loadFromRow(sqlite3pp::query::iterator &aRow, int &aIndex, uint64_t *aCommonFlagsP)
+{
+  inheritedParams::loadFromRow(aRow, aIndex, aCommonFlagsP);
+  for (int i=0; i<numSettingsFields; i++) {
+    const SettingsFieldDef &fdef = settingsFieldDefs[i];
+    switch (fdef.jsonType) {
+      case json_type_boolean: aRow->getIfNotNull(aIndex, FLD(bool, fdef.offset)); break;
+      case json_type_double: aRow->getIfNotNull(aIndex, FLD(double, fdef.offset)); break;
+      case json_type_int: aRow->getIfNotNull(aIndex, FLD(int, fdef.offset)); break;
+      case json_type_string: {
+        const char *s;
+        if (aRow->getIfNotNull(aIndex, s)) {
+          FLD(string, fdef.offset) = s;
+        }
+        break;
+      }
+      default: break; // ignore others
+    }
+    aIndex++;
+  }
+}
+
+
+// bind values to passed statement
+void WiperSettingsParams::bindToStatement(sqlite3pp::statement &aStatement, int &aIndex, const char *aParentIdentifier, uint64_t aCommonFlags)
+{
+  inheritedParams::bindToStatement(aStatement, aIndex, aParentIdentifier, aCommonFlags);
+  // bind the fields
+  for (int i=0; i<numSettingsFields; i++) {
+    const SettingsFieldDef &fdef = settingsFieldDefs[i];
+    switch (fdef.jsonType) {
+      case json_type_boolean: aStatement.bind(aIndex, FLD(bool, fdef.offset)); break;
+      case json_type_double: aStatement.bind(aIndex, FLD(double, fdef.offset)); break;
+      case json_type_int: aStatement.bind(aIndex, FLD(int, fdef.offset)); break;
+      case json_type_string: aStatement.bind(aIndex, FLD(string, fdef.offset).c_str(), false); break;
+      default: aStatement.bind(aIndex); // just bind NULL to unknown types
+    }
+    aIndex++;
+  }
+}
+
+
+
+// MARK: ===== persistent run state
+
+
+WiperRunState::WiperRunState(ParamStore &aParamStore) :
+  inheritedParams(aParamStore),
+  cleanShutdown(false),
+  lastMvState(0),
+  lastAngle(0),
+  lastAngleConfidence(0),
+  motorOnTimeCW(0),
+  motorOnTimeCCW(0),
+  motorDutyTimeCW(0),
+  motorDutyTimeCCW(0),
+  motorReversals(0),
+  swingCycles(0),
+  calibrations(0)
+{
+}
+
+
+ErrorPtr WiperRunState::load()
+{
+  return loadFromStore(NULL);
+}
+
+
+void WiperRunState::save()
+{
+  markDirty();
+  MLMicroSeconds start = MainLoop::now();
+  ErrorPtr err = saveToStore(NULL, false);
+  saveTimes.add(MainLoop::now()-start);
+  if (!Error::isOK(err)) {
+    LOG(LOG_ERR, "cannot save run state: %s", err->description().c_str());
+  }
+}
+
+
+// SQLIte3 table name to store these parameters to
+const char *WiperRunState::tableName()
+{
+  return "WiperState";
+}
+
+
+// data field definitions
+
+static const size_t numRunStateFields = 11;
+
+size_t WiperRunState::numFieldDefs()
+{
+  return inheritedParams::numFieldDefs()+numRunStateFields;
+}
+
+
+const FieldDefinition *WiperRunState::getFieldDef(size_t aIndex)
+{
+  static const FieldDefinition runStateFieldDefs[numRunStateFields] = {
+    { "cleanShutdown", SQLITE_INTEGER },
+    { "lastMvState", SQLITE_INTEGER },
+    { "lastAngle", SQLITE_FLOAT },
+    { "lastAngleConfidence", SQLITE_FLOAT },
+    { "motorOnTimeCW", SQLITE_FLOAT },
+    { "motorOnTimeCCW", SQLITE_FLOAT },
+    { "motorDutyTimeCW", SQLITE_FLOAT },
+    { "motorDutyTimeCCW", SQLITE_FLOAT },
+    { "motorReversals", SQLITE_INTEGER },
+    { "swingCycles", SQLITE_INTEGER },
+    { "calibrations", SQLITE_INTEGER },
+  };
+  if (aIndex<inheritedParams::numFieldDefs())
+    return inheritedParams::getFieldDef(aIndex);
+  aIndex -= inheritedParams::numFieldDefs();
+  if (aIndex<numRunStateFields)
+    return &runStateFieldDefs[aIndex];
+  return NULL;
+}
+
+
+/// load values from passed row
+void WiperRunState::loadFromRow(sqlite3pp::query::iterator &aRow, int &aIndex, uint64_t *aCommonFlagsP)
+{
+  inheritedParams::loadFromRow(aRow, aIndex, aCommonFlagsP);
+  aRow->getIfNotNull(aIndex++, cleanShutdown);
+  aRow->getIfNotNull(aIndex++, lastMvState);
+  aRow->getIfNotNull(aIndex++, lastAngle);
+  aRow->getIfNotNull(aIndex++, lastAngleConfidence);
+  aRow->getIfNotNull(aIndex++, motorOnTimeCW);
+  aRow->getIfNotNull(aIndex++, motorOnTimeCCW);
+  aRow->getIfNotNull(aIndex++, motorDutyTimeCW);
+  aRow->getIfNotNull(aIndex++, motorDutyTimeCCW);
+  aRow->getIfNotNull(aIndex++, motorReversals);
+  aRow->getIfNotNull(aIndex++, swingCycles);
+  aRow->getIfNotNull(aIndex++, calibrations);
+}
+
+
+// bind values to passed statement
+void WiperRunState::bindToStatement(sqlite3pp::statement &aStatement, int &aIndex, const char *aParentIdentifier, uint64_t aCommonFlags)
+{
+  inheritedParams::bindToStatement(aStatement, aIndex, aParentIdentifier, aCommonFlags);
+  aStatement.bind(aIndex++, cleanShutdown);
+  aStatement.bind(aIndex++, lastMvState);
+  aStatement.bind(aIndex++, lastAngle);
+  aStatement.bind(aIndex++, lastAngleConfidence);
+  aStatement.bind(aIndex++, motorOnTimeCW);
+  aStatement.bind(aIndex++, motorOnTimeCCW);
+  aStatement.bind(aIndex++, motorDutyTimeCW);
+  aStatement.bind(aIndex++, motorDutyTimeCCW);
+  aStatement.bind(aIndex++, motorReversals);
+  aStatement.bind(aIndex++, swingCycles);
+  aStatement.bind(aIndex++, calibrations);
+}
@@ -0,0 +1,238 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44wiperd__wipersettings__
+#define __p44wiperd__wipersettings__
+
+#include "p44utils_common.hpp"
+
+#include "persistentparams.hpp"
+#include "jsonobject.hpp"
+#include "metrics.hpp"
+
+using namespace std;
+
+namespace p44 {
+
+
+  // MARK: ===== settings definitions
+
+  typedef struct {
+    const char *fieldName;
+    const char *title;
+    json_type jsonType;
+    size_t offset;
+    double min;
+    double max;
+    double res;
+    double def;
+  } SettingsFieldDef;
+
+
+  enum {
+    wiper_mechanical = 0,
+    wiper_software = 1
+  };
+
+
+  typedef struct {
+    int initialMode; ///< initial run mode
+    int wiperType; ///< initial run mode
+    double calibratePower; ///< calibration power [%]
+    double calibrateRotationTime; ///< time a full rotation takes at calibration power [Seconds]
+    double rezeroSwingAngle; ///< max rezero swing from initial position [degrees]
+    double findZeroRamp; ///< full power ramp time during zero position find [Seconds]
+    double swingMaxPower; ///< swing max power [%]
+    double swingMinPower; ///< swing min power [%]
+    double swingPeriod; ///< swing period [seconds]
+    double swingCurveExp; ///< swing power curve exponent, -1.85 is near sine wave
+    double midPointAdjustTime; ///< midpoint adjust ramp time [Seconds]
+    double midPointSearchTime; ///< max time waiting for midpoint after swingdown ramp [Seconds]
+    double dirChangeTime; ///< time for changing direction [Seconds]
+    double runTimeAfterMovement; ///< how long wiper runs after detecting movement [Seconds]
+    double maxRunTime; ///< how long wiper will run totally (including retriggers) [Seconds]
+    double pauseTime; ///< how long wiper will not trigger again after a completed movement phase [Seconds]
+    double haltTime; // full ramp time when halting wiper [Seconds]",
+    int swingCurveType; ///< swing ramp profile: 0=exponential, 1=S-curve, 2=sine waveform, 3=user waveform
+    double reversalBrakePower; ///< active braking power at swing reversals, 0=none [%]
+    double reversalBrakeTime; ///< active braking time at swing reversals (part of dirChangeTime) [Seconds]
+    double watchdogLimit; ///< mainloop stall time after which the motor is stopped, 0=never [Seconds]
+    double preArmTime; ///< auto mode: time before end of pause to start holding idle power, 0=never [Seconds]
+    double preArmPower; ///< auto mode: idle power held towards the next swing while pre-armed [%]
+    double positionMaxPower; ///< positioning: max driving power [%]
+    double positionMinPower; ///< positioning: min power to move the arm [%]
+    double positionGain; ///< positioning: power per degree of error [%/degree]
+    double positionDamping; ///< positioning: power reduction per degree/second of speed [%/(degree/Second)]
+    double positionTolerance; ///< positioning: error within which target is reached [degrees]
+  } WiperSettings;
+
+
+  extern const SettingsFieldDef settingsFieldDefs[];
+  extern const int numSettingsFields;
+
+
+
+  // MARK: ===== settings DB database
+
+
+  // Version history
+  //  1 : initial version
+  //  2 : added MotionPatterns table
+  //  3 : added ScheduleWindows table
+  #define WIPERPARAMS_SCHEMA_VERSION 3 // current version
+  #define WIPERPARAMS_SCHEMA_MIN_VERSION 1 // minimally supported version, anything older will be deleted
+
+  /// persistence for wiper parameters
+  class WiperParamStore : public ParamStore
+  {
+    typedef SQLite3Persistence inherited;
+  protected:
+
+    /// Get DB Schema creation/upgrade SQL statements
+    virtual string dbSchemaUpgradeSQL(int aFromVersion, int &aToVersion);
+
+  };
+
+
+
+  // MARK: ===== persistent settings
+
+
+  /// the wiper settings, with JSON access and persistence
+  class WiperSettingsParams : public PersistentParams, public WiperSettings
+  {
+    typedef PersistentParams inheritedParams;
+
+  public:
+
+    WiperSettingsParams(ParamStore &aParamStore);
+
+    /// @name settings access
+    /// @{
+
+    /// reset all settings to their defaults
+    void default_settings();
+
+    /// log all settings (at LOG_INFO)
+    void logParams();
+
+    /// @param aFdef the field definition
+    /// @return the current value of the field as JSON
+    JsonObjectPtr fieldAsJSON(const SettingsFieldDef &aFdef);
+
+    /// set a field from JSON, limiting the value to the field's min..max range
+    /// @param aFdef the field definition
+    /// @param aValue the new value
+    void JSONtoField(const SettingsFieldDef &aFdef, JsonObjectPtr aValue);
+
+    /// process a "settings" API request
+    /// @param aData the request data (can be NULL for plain reads)
+    /// @param aIsAction true if request is an action (write)
+    /// @param aResult will be set to the result object, if any
+    /// @return ok or error
+    ErrorPtr processRequest(JsonObjectPtr aData, bool aIsAction, JsonObjectPtr &aResult);
+
+    /// validate a JSON object with fieldName:value pairs and apply the fields that differ from the current values.
+    /// Nothing is applied unless all fields are known, of the right type and within their min..max range.
+    /// Changed fields are saved to the database, unchanged ones cause no database write at all.
+    /// @param aSettings the settings object
+    /// @param aNumChanged will be set to the number of fields that actually changed
+    /// @return ok or error describing the first invalid field
+    ErrorPtr applyJSON(JsonObjectPtr aSettings, int &aNumChanged);
+
+    /// read settings from a JSON file and apply them with applyJSON()
+    /// @param aFilePath the file path
+    /// @param aNumChanged will be set to the number of fields that actually changed
+    /// @return ok or error
+    ErrorPtr applyFile(const string &aFilePath, int &aNumChanged);
+
+    /// @}
+
+    /// @name persistence
+    /// @{
+
+    ErrorPtr load();
+    void save();
+    void saveChanges();
+
+    DurationSummary saveTimes; ///< time spent saving to the database
+
+    /// @}
+
+  protected:
+
+    // PersistentParams API
+    virtual const char *tableName();
+    virtual size_t numFieldDefs();
+    virtual const FieldDefinition *getFieldDef(size_t aIndex);
+    virtual void loadFromRow(sqlite3pp::query::iterator &aRow, int &aIndex, uint64_t *aCommonFlagsP);
+    virtual void bindToStatement(sqlite3pp::statement &aStatement, int &aIndex, const char *aParentIdentifier, uint64_t aCommonFlags);
+
+  };
+
+
+
+  // MARK: ===== persistent run state
+
+
+  /// runtime state that is saved at clean shutdown and can be trusted at next startup
+  class WiperRunState : public PersistentParams
+  {
+    typedef PersistentParams inheritedParams;
+
+  public:
+
+    WiperRunState(ParamStore &aParamStore);
+
+    bool cleanShutdown; ///< set when the daemon was shut down cleanly, so the state below is valid
+    int lastMvState; ///< movement state at shutdown
+    double lastAngle; ///< estimated angle at shutdown [degrees]
+    double lastAngleConfidence; ///< confidence of lastAngle, 0..1
+
+    // lifetime usage counters (checkpointed periodically, not on every change)
+    double motorOnTimeCW; ///< [Seconds]
+    double motorOnTimeCCW; ///< [Seconds]
+    double motorDutyTimeCW; ///< energy proxy, PWM duty x time [full power equivalent Seconds]
+    double motorDutyTimeCCW; ///< energy proxy, PWM duty x time [full power equivalent Seconds]
+    long long motorReversals;
+    long long swingCycles;
+    long long calibrations;
+
+    ErrorPtr load();
+    void save();
+
+    DurationSummary saveTimes; ///< time spent saving to the database
+
+  protected:
+
+    // PersistentParams API
+    virtual const char *tableName();
+    virtual size_t numFieldDefs();
+    virtual const FieldDefinition *getFieldDef(size_t aIndex);
+    virtual void loadFromRow(sqlite3pp::query::iterator &aRow, int &aIndex, uint64_t *aCommonFlagsP);
+    virtual void bindToStatement(sqlite3pp::statement &aStatement, int &aIndex, const char *aParentIdentifier, uint64_t aCommonFlags);
+
+  };
+
+
+} // namespace p44
+
+#endif /* defined(__p44wiperd__wipersettings__) */
@@ -0,0 +1,92 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44wiperd.
+//
+//  p44wiperd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44wiperd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44wiperd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __p44wiperd__wiperstatusblock__
+#define __p44wiperd__wiperstatusblock__
+
+// Layout of the shared memory status block published by p44wiperd (--statusblock).
+// Plain C layout without any p44utils dependencies, so local consumers can include this file alone.
+//
+// Consistency protocol (seqlock): the writer increments seq to an odd value, updates data, then
+// increments seq to the next even value. A reader copies data and accepts the copy only if seq was
+// even and unchanged before and after copying.
+
+#include <stdint.h>
+#include <string.h>
+
+#define WIPER_STATUSBLOCK_MAGIC 0x52505750 // "PWPR" in memory on little endian
+#define WIPER_STATUSBLOCK_VERSION 1
+
+typedef struct {
+  int64_t publishedAt; ///< unix time of last update [uS]
+  int64_t runUntil; ///< unix time when the current auto mode run ends, 0 if none [uS]
+  double power; ///< current motor power 0..100 [%]
+  int32_t direction; ///< current motor direction 1=CW, -1=CCW, 0=stopped
+  int32_t mvState; ///< movement state (same numbering as "mvState" in the JSON API status)
+  int32_t runMode; ///< run mode 0=off, 1=auto, 2=always, 3=position
+  int32_t swinging; ///< 1 if swing or motion pattern is active
+  int32_t alive; ///< 1 while the daemon is running, 0 after it has shut down
+  int32_t reserved;
+  int64_t swingCycles; ///< swing cycles this session
+  int64_t motorReversals; ///< motor direction reversals this session
+  int64_t movementTriggers; ///< movement sensor triggers this session
+  int64_t calibrations; ///< calibrations this session
+  int64_t zeroFindFailures; ///< failed zero position searches this session
+} WiperStatusData;
+
+typedef struct {
+  uint32_t magic; ///< WIPER_STATUSBLOCK_MAGIC
+  uint32_t version; ///< WIPER_STATUSBLOCK_VERSION
+  uint32_t dataSize; ///< sizeof(WiperStatusData) as seen by the writer
+  volatile uint32_t seq; ///< odd while data is being written
+  WiperStatusData data;
+} WiperStatusBlock;
+
+
+/// update the status block (single writer only)
+static inline void wiperStatusWrite(WiperStatusBlock *aBlock, const WiperStatusData *aData)
+{
+  aBlock->seq++;
+  __sync_synchronize();
+  memcpy((void *)&aBlock->data, aData, sizeof(WiperStatusData));
+  __sync_synchronize();
+  aBlock->seq++;
+}
+
+
+/// read a consistent copy of the status block data
+/// @param aMaxTries how many times to retry when the writer was active while copying
+/// @return 1 if aData contains a consistent copy, 0 if none could be obtained within aMaxTries
+static inline int wiperStatusRead(const WiperStatusBlock *aBlock, WiperStatusData *aData, int aMaxTries)
+{
+  while (aMaxTries-->0) {
+    uint32_t s = aBlock->seq;
+    if (s & 1) continue; // writer active
+    __sync_synchronize();
+    memcpy(aData, (const void *)&aBlock->data, sizeof(WiperStatusData));
+    __sync_synchronize();
+    if (aBlock->seq==s) return 1;
+  }
+  return 0;
+}
+
+#endif /* defined(__p44wiperd__wiperstatusblock__) */